@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "aggregate.h"
+
+//records are visited in blocks that line up with the words of the deleted bitmap
+#define AGGREGATE_BLOCK 64
+
+//four lanes of unsigned long, lowered to whatever SIMD width the target has
+typedef unsigned long ulong4 __attribute__((vector_size(4 * sizeof(unsigned long))));
+
+/*
+ * running totals of aggregate_records, one per lane
+ * sums are split into the low and high 32 bits of each count so a lane cannot overflow before 2^32 records
+ */
+typedef struct SummaryLanes {
+	ulong4 sumLow;
+	ulong4 sumHigh;
+	ulong4 followerMin;
+	ulong4 followerMax;
+	ulong4 dateMin;
+	ulong4 dateMax;
+	long count;
+} SummaryLanes;
+
+/*
+ * one thread's share of a pass: records [begin, end) and what it found there
+ */
+typedef struct AggregateTask {
+	Database *db;
+	int begin;
+	int end;
+	SummaryLanes lanes;
+	unsigned long lo; //histogram: value of the first bucket's lower edge
+	unsigned long width; //histogram: values per bucket
+	int buckets;
+	long *counts; //histogram: 'buckets' counts for each task, this task's at 'index'
+	int index; //position of this task among those of the pass
+} AggregateTask;
+
+//keeps the smaller of *min and v in each lane; vectors go by pointer so no vector crosses a call boundary
+static inline void lane_min(ulong4 *min, ulong4 const *v){
+	ulong4 less = (ulong4)(*v < *min); //all ones where v wins
+	*min = (*v & less) | (*min & ~less);
+}
+
+static inline void lane_max(ulong4 *max, ulong4 const *v){
+	ulong4 greater = (ulong4)(*v > *max);
+	*max = (*v & greater) | (*max & ~greater);
+}
+
+/*
+ * @param int threads requested thread count, 0 to pick one from the table size and the number of CPUs
+ * @return the number of threads to use over 'size' records
+ */
+static int thread_count(int size, int threads){
+	if(threads <= 0){
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = size < AGGREGATE_PARALLEL_MIN || cpus < 1 ? 1 : (int)cpus;
+	}
+	if(threads > AGGREGATE_MAX_THREADS){
+		threads = AGGREGATE_MAX_THREADS;
+	}
+	return threads;
+}
+
+/*
+ * copies the live records of one block into contiguous arrays
+ * @param unsigned long deadBits the block's word of the deleted bitmap
+ * @param *dates NULL if only followers are wanted
+ * @return number of values copied
+ */
+static int gather_block(Database *db, int start, int n, unsigned long deadBits, unsigned long *followers, unsigned long *dates){
+	int count = 0;
+	for(int i = 0; i < n; i++){
+		if(deadBits >> i & 1){
+			continue;
+		}
+		if(db->followerColumn != NULL){
+			followers[count] = db->followerColumn[start + i];
+			if(dates != NULL){
+				dates[count] = db->dateColumn[start + i];
+			}
+		}else{
+			followers[count] = db->records[start + i].followerCount;
+			if(dates != NULL){
+				dates[count] = db->records[start + i].dateLastModified;
+			}
+		}
+		count++;
+	}
+	return count;
+}
+
+/*
+ * folds n followers and dates into the lanes, four at a time
+ */
+static void summarize_block(SummaryLanes *lanes, unsigned long const *followers, unsigned long const *dates, int n){
+	ulong4 low = { 0xffffffffUL, 0xffffffffUL, 0xffffffffUL, 0xffffffffUL };
+	int i = 0;
+
+	for(; i + 4 <= n; i += 4){
+		ulong4 f, d;
+		memcpy(&f, followers + i, sizeof(f));
+		memcpy(&d, dates + i, sizeof(d));
+		lanes->sumLow += f & low;
+		lanes->sumHigh += f >> 32;
+		lane_min(&lanes->followerMin, &f);
+		lane_max(&lanes->followerMax, &f);
+		lane_min(&lanes->dateMin, &d);
+		lane_max(&lanes->dateMax, &d);
+	}
+	for(; i < n; i++){ //leftovers go to the first lane
+		lanes->sumLow[0] += followers[i] & 0xffffffffUL;
+		lanes->sumHigh[0] += followers[i] >> 32;
+		lanes->followerMin[0] = followers[i] < lanes->followerMin[0] ? followers[i] : lanes->followerMin[0];
+		lanes->followerMax[0] = followers[i] > lanes->followerMax[0] ? followers[i] : lanes->followerMax[0];
+		lanes->dateMin[0] = dates[i] < lanes->dateMin[0] ? dates[i] : lanes->dateMin[0];
+		lanes->dateMax[0] = dates[i] > lanes->dateMax[0] ? dates[i] : lanes->dateMax[0];
+	}
+	lanes->count += n;
+}
+
+/*
+ * summarizes one task's records; columns without deleted records are read in place, anything else is gathered first
+ */
+static void *summarize_task(void *arg){
+	AggregateTask *task = arg;
+	Database *db = task->db;
+	unsigned long followers[AGGREGATE_BLOCK];
+	unsigned long dates[AGGREGATE_BLOCK];
+
+	for(int start = task->begin; start < task->end; start += AGGREGATE_BLOCK){
+		int n = task->end - start < AGGREGATE_BLOCK ? task->end - start : AGGREGATE_BLOCK;
+		unsigned long deadBits = db->dead != NULL ? db->dead[start / AGGREGATE_BLOCK] : 0;
+		if(db->followerColumn != NULL && deadBits == 0){
+			summarize_block(&task->lanes, db->followerColumn + start, db->dateColumn + start, n);
+		}else{
+			int count = gather_block(db, start, n, deadBits, followers, dates);
+			summarize_block(&task->lanes, followers, dates, count);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * counts one task's records into its histogram buckets
+ */
+static void *histogram_task(void *arg){
+	AggregateTask *task = arg;
+	Database *db = task->db;
+	unsigned long followers[AGGREGATE_BLOCK];
+	long *counts = task->counts + (size_t)task->index * task->buckets;
+
+	for(int start = task->begin; start < task->end; start += AGGREGATE_BLOCK){
+		int n = task->end - start < AGGREGATE_BLOCK ? task->end - start : AGGREGATE_BLOCK;
+		unsigned long deadBits = db->dead != NULL ? db->dead[start / AGGREGATE_BLOCK] : 0;
+		unsigned long const *values = followers;
+		if(db->followerColumn != NULL && deadBits == 0){
+			values = db->followerColumn + start;
+		}else{
+			n = gather_block(db, start, n, deadBits, followers, NULL);
+		}
+		for(int i = 0; i < n; i++){
+			unsigned long bucket = (values[i] - task->lo) / task->width;
+			counts[bucket < (unsigned long)task->buckets ? bucket : (unsigned long)task->buckets - 1]++;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * splits the table into block aligned ranges and runs 'work' on each, the last one on the calling thread
+ * @return the tasks, which the caller frees
+ */
+static AggregateTask *run_tasks(Database *db, int threads, void *(*work)(void *), AggregateTask const *prototype){
+	threads = thread_count(db->size, threads);
+	AggregateTask *tasks = malloc(threads * sizeof(AggregateTask));
+	pthread_t *ids = malloc(threads * sizeof(pthread_t));
+	if(tasks == NULL || ids == NULL){
+		fprintf(stderr, "Failed memory allocation.\n");
+		exit(1);
+	}
+
+	int blocks = (db->size + AGGREGATE_BLOCK - 1) / AGGREGATE_BLOCK;
+	for(int t = 0; t < threads; t++){
+		tasks[t] = *prototype;
+		tasks[t].db = db;
+		tasks[t].index = t;
+		tasks[t].begin = (int)((long)blocks * t / threads) * AGGREGATE_BLOCK;
+		tasks[t].end = (int)((long)blocks * (t + 1) / threads) * AGGREGATE_BLOCK;
+		if(tasks[t].end > db->size){
+			tasks[t].end = db->size;
+		}
+	}
+
+	int started = 0;
+	for(; started < threads - 1; started++){
+		if(pthread_create(&ids[started], NULL, work, &tasks[started]) != 0){
+			break; //the calling thread picks up what could not be started
+		}
+	}
+	for(int t = started; t < threads; t++){
+		work(&tasks[t]);
+	}
+	for(int t = 0; t < started; t++){
+		pthread_join(ids[t], NULL);
+	}
+	free(ids);
+	return tasks;
+}
+
+/*
+ * counts, sums and finds the extremes of followerCount, and the extremes of dateLastModified, over every live record
+ * reads the columns in columnar mode and the records otherwise
+ * @param int threads number of threads, 0 to use every CPU on tables of at least AGGREGATE_PARALLEL_MIN records
+ */
+void aggregate_records(Database *db, Aggregate *result, int threads){
+	AggregateTask prototype;
+	memset(&prototype, 0, sizeof(prototype));
+	prototype.lanes.followerMin -= 1; //every lane starts at ULONG_MAX
+	prototype.lanes.dateMin -= 1;
+
+	threads = thread_count(db->size, threads);
+	AggregateTask *tasks = run_tasks(db, threads, summarize_task, &prototype);
+
+	SummaryLanes total = prototype.lanes;
+	for(int t = 0; t < threads; t++){
+		total.sumLow += tasks[t].lanes.sumLow; //each lane saw at most a quarter of the records, so this cannot wrap
+		total.sumHigh += tasks[t].lanes.sumHigh;
+		lane_min(&total.followerMin, &tasks[t].lanes.followerMin);
+		lane_max(&total.followerMax, &tasks[t].lanes.followerMax);
+		lane_min(&total.dateMin, &tasks[t].lanes.dateMin);
+		lane_max(&total.dateMax, &tasks[t].lanes.dateMax);
+		total.count += tasks[t].lanes.count;
+	}
+	free(tasks);
+
+	result->count = total.count;
+	result->followerSum = 0;
+	result->followerMin = ULONG_MAX;
+	result->followerMax = 0;
+	result->dateMin = ULONG_MAX;
+	result->dateMax = 0;
+	for(int lane = 0; lane < 4; lane++){
+		result->followerSum += ((unsigned __int128)total.sumHigh[lane] << 32) + total.sumLow[lane];
+		result->followerMin = total.followerMin[lane] < result->followerMin ? total.followerMin[lane] : result->followerMin;
+		result->followerMax = total.followerMax[lane] > result->followerMax ? total.followerMax[lane] : result->followerMax;
+		result->dateMin = total.dateMin[lane] < result->dateMin ? total.dateMin[lane] : result->dateMin;
+		result->dateMax = total.dateMax[lane] > result->dateMax ? total.dateMax[lane] : result->dateMax;
+	}
+}
+
+/*
+ * moves the k-th smallest of values[0..n) to position k, with smaller ones before it and larger ones after
+ * three way partitioning keeps tables full of equal counts, such as zero, linear
+ */
+static void select_kth(unsigned long *values, long n, long k){
+	long lo = 0;
+	long hi = n - 1;
+
+	while(lo < hi){
+		unsigned long a = values[lo], b = values[lo + (hi - lo) / 2], c = values[hi];
+		unsigned long pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+		long lt = lo, i = lo, gt = hi;
+		while(i <= gt){
+			unsigned long v = values[i];
+			if(v < pivot){
+				values[i++] = values[lt];
+				values[lt++] = v;
+			}else if(v > pivot){
+				values[i] = values[gt];
+				values[gt--] = v;
+			}else{
+				i++;
+			}
+		}
+		if(k < lt){
+			hi = lt - 1;
+		}else if(k > gt){
+			lo = gt + 1;
+		}else{
+			return; //k falls among the values equal to the pivot
+		}
+	}
+}
+
+/*
+ * @return the median followerCount of the live records, the mean of the middle two for an even count, 0 if there are none
+ * selects on a copy in expected linear time rather than sorting
+ */
+long double aggregate_median(Database *db){
+	unsigned long *values = malloc(((size_t)db_live_records(db) + 1) * sizeof(unsigned long));
+	if(values == NULL){
+		fprintf(stderr, "Failed memory allocation.\n");
+		exit(1);
+	}
+
+	long n = 0;
+	for(int start = 0; start < db->size; start += AGGREGATE_BLOCK){
+		int size = db->size - start < AGGREGATE_BLOCK ? db->size - start : AGGREGATE_BLOCK;
+		unsigned long deadBits = db->dead != NULL ? db->dead[start / AGGREGATE_BLOCK] : 0;
+		n += gather_block(db, start, size, deadBits, values + n, NULL);
+	}
+	if(n == 0){
+		free(values);
+		return 0;
+	}
+
+	long k = (n - 1) / 2;
+	select_kth(values, n, k);
+	long double median = values[k];
+	if(n % 2 == 0){
+		//everything after position k is at least values[k], so the upper middle is the smallest of them
+		unsigned long upper = ULONG_MAX;
+		for(long i = k + 1; i < n; i++){
+			upper = values[i] < upper ? values[i] : upper;
+		}
+		median = (median + upper) / 2;
+	}
+	free(values);
+	return median;
+}
+
+/*
+ * counts the live records per followerCount bucket; bucket i holds counts in [lo + i * width, lo + (i + 1) * width)
+ * no count may be below lo; counts past the last bucket go into it, which happens when a width that would cover
+ * the whole range does not fit in an unsigned long
+ * @param *counts 'buckets' entries, overwritten
+ * @param int threads number of threads, 0 to use every CPU on tables of at least AGGREGATE_PARALLEL_MIN records
+ */
+void aggregate_histogram(Database *db, unsigned long lo, unsigned long width, int buckets, long *counts, int threads){
+	AggregateTask prototype;
+	memset(&prototype, 0, sizeof(prototype));
+	prototype.lo = lo;
+	prototype.width = width;
+	prototype.buckets = buckets;
+
+	threads = thread_count(db->size, threads);
+	prototype.counts = calloc((size_t)threads * buckets, sizeof(long));
+	if(prototype.counts == NULL){
+		fprintf(stderr, "Failed memory allocation.\n");
+		exit(1);
+	}
+	AggregateTask *tasks = run_tasks(db, threads, histogram_task, &prototype);
+
+	memset(counts, 0, buckets * sizeof(long));
+	for(int t = 0; t < threads; t++){
+		for(int b = 0; b < buckets; b++){
+			counts[b] += prototype.counts[t * buckets + b];
+		}
+	}
+	free(tasks);
+	free(prototype.counts);
+}
@@ -0,0 +1,28 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "database.h"
+
+//tables with at least this many records are summarized on several threads
+#define AGGREGATE_PARALLEL_MIN (1 << 20)
+#define AGGREGATE_MAX_THREADS 16
+
+/*
+ * totals over every live record, gathered in one pass
+ */
+typedef struct Aggregate {
+ long count; //number of live records
+ unsigned __int128 followerSum; //wide enough that no table of ulong counts can overflow it
+ unsigned long followerMin;
+ unsigned long followerMax;
+ unsigned long dateMin; //oldest dateLastModified
+ unsigned long dateMax; //newest dateLastModified
+} Aggregate;
+
+void aggregate_records(Database * db, Aggregate * result, int threads);
+
+long double aggregate_median(Database * db);
+
+void aggregate_histogram(Database * db, unsigned long lo, unsigned long width, int buckets, long * counts, int threads);
+
+#endif
@@ -0,0 +1,999 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <limits.h>
+#include "database.h"
+#include "bench_sharded.h"
+
+//shards used by the shards mode
+#define BENCH_SHARDS 16
+#include "snapshot.h"
+#include "output.h"
+#include "aggregate.h"
+#include "merge.h"
+#include "codec.h"
+
+/*
+ * returns a monotonic timestamp in seconds
+ */
+double now_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * fills a synthetic record whose handle is derived from n
+ */
+void make_record(Record *record, long n){
+    static char comment[COMMENT_SIZE]; //db_append interns it, so one buffer serves every record
+    memset(record, 0, sizeof(*record));
+    snprintf(record->handle, sizeof(record->handle), "@user%ld", n);
+    snprintf(comment, sizeof(comment), "comment %ld", n % 1000);
+    record->comment = comment;
+    record->followerCount = (unsigned long)(n * 7919) % 100000000;
+    record->dateLastModified = 1600000000 + (unsigned long)n;
+}
+
+/*
+ * @return 1 if both tables hold the same records in the same order, comments compared by content
+ */
+int same_records(Database const *a, Database const *b){
+    if(a->size != b->size){
+        return 0;
+    }
+    for(int i = 0; i < a->size; i++){
+        Record const *x = &a->records[i];
+        Record const *y = &b->records[i];
+        if(memcmp(x->handle, y->handle, sizeof(x->handle)) != 0 || x->followerCount != y->followerCount
+           || x->dateLastModified != y->dateLastModified || strcmp(x->comment, y->comment) != 0){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * the lookup that db_lookup used to do, kept here as the baseline
+ */
+Record *linear_lookup(Database *db, char const *handle){
+    for(int i = 0; i < db->size; i++){
+        if(strcmp(db->records[i].handle, handle) == 0){
+            return &(db->records[i]);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * times hits and misses against the hash index and against a linear scan
+ * @param long n number of records to put in the database
+ */
+void bench_lookup(long n){
+    Database db = db_create();
+    Record record;
+    char handle[32];
+
+    double start = now_seconds();
+    for(long i = 0; i < n; i++){
+        make_record(&record, i);
+        db_append(&db, &record);
+    }
+    double appendTime = now_seconds() - start;
+
+    //the linear scan is O(n) per lookup so it gets fewer iterations on big tables
+    long hashLookups = 1000000;
+    long linearLookups = n > 100000 ? 20 : 2000;
+    long found = 0;
+
+    start = now_seconds();
+    for(long i = 0; i < hashLookups; i++){
+        snprintf(handle, sizeof(handle), "@user%ld", (i * 104729) % n);
+        found += db_lookup(&db, handle) != NULL;
+    }
+    double hashHit = (now_seconds() - start) / hashLookups;
+
+    start = now_seconds();
+    for(long i = 0; i < hashLookups; i++){
+        snprintf(handle, sizeof(handle), "@missing%ld", i);
+        found += db_lookup(&db, handle) != NULL;
+    }
+    double hashMiss = (now_seconds() - start) / hashLookups;
+
+    start = now_seconds();
+    for(long i = 0; i < linearLookups; i++){
+        snprintf(handle, sizeof(handle), "@user%ld", (i * 104729) % n);
+        found += linear_lookup(&db, handle) != NULL;
+    }
+    double linearHit = (now_seconds() - start) / linearLookups;
+
+    start = now_seconds();
+    for(long i = 0; i < linearLookups; i++){
+        snprintf(handle, sizeof(handle), "@missing%ld", i);
+        found += linear_lookup(&db, handle) != NULL;
+    }
+    double linearMiss = (now_seconds() - start) / linearLookups;
+
+    printf("%10ld records | append %8.3f s | hash hit %8.0f ns miss %8.0f ns | linear hit %12.0f ns miss %12.0f ns | speedup %.0fx\n",
+           n, appendTime, hashHit * 1e9, hashMiss * 1e9, linearHit * 1e9, linearMiss * 1e9,
+           linearHit / hashHit);
+
+    if(found != hashLookups + linearLookups){ //every hit should be found and no miss
+        fprintf(stderr, "Error: lookup returned wrong results.\n");
+    }
+    db_free(&db);
+}
+
+/*
+ * writes a synthetic CSV file with n records to path
+ */
+void make_csv(char const *path, long n){
+    Database db = db_create();
+    Record record;
+    for(long i = 0; i < n; i++){
+        make_record(&record, i);
+        db_append(&db, &record);
+    }
+    db_write_csv(&db, path);
+    db_free(&db);
+}
+
+/*
+ * the loader before db_load_csv parsed in place: getline, parse_record, db_append
+ */
+void reference_load_csv(Database *db, char const *path){
+    FILE *file = fopen(path, "rt");
+    char *line = NULL;
+    size_t len = 0;
+
+    char comment[COMMENT_SIZE];
+
+    while(getline(&line, &len, file) != -1){
+        Record record = parse_record(line, comment);
+        db_append(db, &record);
+    }
+    free(line);
+    fclose(file);
+}
+
+/*
+ * compares load throughput of db_load_csv against the getline + parse_record path
+ * @param long n number of rows in the generated file
+ */
+void bench_load(long n){
+    char const *path = "/tmp/igdb_bench.csv";
+    make_csv(path, n);
+
+    struct stat st;
+    stat(path, &st);
+    double megabytes = st.st_size / 1e6;
+
+    Database reference = db_create();
+    double start = now_seconds();
+    reference_load_csv(&reference, path);
+    double referenceTime = now_seconds() - start;
+
+    Database db = db_create();
+    start = now_seconds();
+    db_load_csv(&db, path);
+    double loadTime = now_seconds() - start;
+
+    printf("%10ld records %8.1f MB | getline+parse_record %8.1f MB/s | db_load_csv %8.1f MB/s | speedup %.2fx\n",
+           n, megabytes, megabytes / referenceTime, megabytes / loadTime, referenceTime / loadTime);
+
+    //the same two parsers without appending, to separate parsing from growing the table
+    FILE *file = fopen(path, "rt");
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t nread;
+    Record record;
+    char comment[COMMENT_SIZE];
+    char const *slice;
+    size_t sliceLength;
+    unsigned long checksum = 0;
+
+    start = now_seconds();
+    while(getline(&line, &len, file) != -1){
+        record = parse_record(line, comment);
+        checksum += record.followerCount;
+    }
+    double referenceParse = now_seconds() - start;
+
+    rewind(file);
+    start = now_seconds();
+    while((nread = getline(&line, &len, file)) != -1){
+        parse_line(line, line + nread - 1, &record, &slice, &sliceLength);
+        checksum -= record.followerCount;
+    }
+    double parseTime = now_seconds() - start;
+    free(line);
+    fclose(file);
+
+    printf("%10ld records parse only | parse_record %8.1f MB/s | parse_line %8.1f MB/s | speedup %.2fx\n",
+           n, megabytes / referenceParse, megabytes / parseTime, referenceParse / parseTime);
+    if(checksum != 0){
+        fprintf(stderr, "Error: parsers disagree.\n");
+    }
+
+    if(!same_records(&reference, &db)){
+        fprintf(stderr, "Error: loaders disagree.\n");
+    }
+
+    //the parallel loader must produce exactly the same table at any thread count
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threadCounts[] = {2, 4, (int)cpus};
+    for(int i = 0; i < 3; i++){
+        Database parallel = db_create();
+        start = now_seconds();
+        db_load_csv_parallel(&parallel, path, threadCounts[i]);
+        double parallelTime = now_seconds() - start;
+
+        printf("%10ld records %8.1f MB | db_load_csv_parallel %3d threads %8.1f MB/s | speedup %.2fx\n",
+               n, megabytes, threadCounts[i], megabytes / parallelTime, loadTime / parallelTime);
+        if(!same_records(&parallel, &db)){
+            fprintf(stderr, "Error: parallel loader disagrees.\n");
+        }
+        db_free(&parallel);
+    }
+    db_free(&reference);
+    db_free(&db);
+    unlink(path);
+}
+
+/*
+ * compares startup from a CSV file against startup from a snapshot of the same table
+ * @param long n number of records in the table
+ */
+void bench_snapshot(long n){
+    char const *csvPath = "/tmp/igdb_bench.csv";
+    char const *snapPath = "/tmp/igdb_bench.snap";
+    make_csv(csvPath, n);
+
+    Database db = db_create();
+    double start = now_seconds();
+    db_load_csv(&db, csvPath);
+    double csvTime = now_seconds() - start;
+    snapshot_write(&db, snapPath);
+
+    Database mapped = db_create();
+    start = now_seconds();
+    snapshot_load(&mapped, snapPath);
+    double snapTime = now_seconds() - start;
+
+    //touch every record so the page faults are part of the measurement
+    unsigned long sum = 0;
+    for(int i = 0; i < mapped.size; i++){
+        sum += mapped.records[i].followerCount;
+    }
+    double touchTime = now_seconds() - start;
+
+    printf("%10ld records | csv load %8.3f s | snapshot load %8.3f s | snapshot load + touch %8.3f s\n",
+           n, csvTime, snapTime, touchTime);
+
+    if(!same_records(&mapped, &db) || sum == 1){
+        fprintf(stderr, "Error: snapshot does not match the CSV table.\n");
+    }
+    db_free(&db);
+    db_free(&mapped);
+    unlink(csvPath);
+    unlink(snapPath);
+}
+
+/*
+ * the list row as db_list printed it before the output engine
+ */
+void reference_list_record(FILE *file, Record const *record){
+    char dateStr[20];
+    time_t date = record->dateLastModified;
+    strftime(dateStr, sizeof(dateStr), "%Y-%m-%d %H:%M", localtime(&date));
+    fprintf(file, "%-20.20s | %-10lu | %-19s | %-30.30s\n",
+            record->handle, record->followerCount, dateStr, record->comment);
+}
+
+/*
+ * renders the table as a list and as CSV to /dev/null, with stdio and with the output engine
+ * @param long n number of records in the table
+ */
+void bench_output(long n){
+    Database db = db_create();
+    Record record;
+    for(long i = 0; i < n; i++){
+        make_record(&record, i);
+        db_append(&db, &record);
+    }
+
+    FILE *file = fopen("/dev/null", "w");
+    double start = now_seconds();
+    for(int i = 0; i < db.size; i++){
+        reference_list_record(file, &db.records[i]);
+    }
+    fflush(file);
+    double referenceList = now_seconds() - start;
+
+    start = now_seconds();
+    for(int i = 0; i < db.size; i++){
+        fprintf(file, "%s,%lu,%s,%lu\n", db.records[i].handle, db.records[i].followerCount,
+                db.records[i].comment, db.records[i].dateLastModified);
+    }
+    fflush(file);
+    double referenceCsv = now_seconds() - start;
+
+    OutBuf out;
+    out_open(&out, fileno(file));
+    start = now_seconds();
+    for(int i = 0; i < db.size; i++){
+        out_list_record(&out, &db.records[i]);
+    }
+    out_flush(&out);
+    double list = now_seconds() - start;
+
+    start = now_seconds();
+    for(int i = 0; i < db.size; i++){
+        out_csv_record(&out, &db.records[i]);
+    }
+    out_flush(&out);
+    double csv = now_seconds() - start;
+    out_close(&out);
+    fclose(file);
+
+    printf("%10ld records | list: printf %8.3f s, engine %8.3f s (%.1fx) | csv: fprintf %8.3f s, engine %8.3f s (%.1fx)\n",
+           n, referenceList, list, referenceList / list, referenceCsv, csv, referenceCsv / csv);
+    db_free(&db);
+}
+
+/*
+ * times a filtered count over followerCount with the records array (AoS) and with the follower column (SoA)
+ * @param long n number of records in the table
+ */
+void bench_scan(long n){
+    Database db = db_create();
+    Record record;
+    db_reserve(&db, (int)n);
+    for(long i = 0; i < n; i++){
+        make_record(&record, i);
+        db_append(&db, &record);
+    }
+
+    //a quarter of the synthetic counts fall in this range
+    unsigned long lo = 25000000, hi = 49999999;
+    int rounds = 10;
+
+    double start = now_seconds();
+    long aos = 0;
+    for(int r = 0; r < rounds; r++){
+        aos += db_count_followers(&db, lo, hi);
+    }
+    double aosTime = (now_seconds() - start) / rounds;
+
+    db_enable_columns(&db);
+    start = now_seconds();
+    long soa = 0;
+    for(int r = 0; r < rounds; r++){
+        soa += db_count_followers(&db, lo, hi);
+    }
+    double soaTime = (now_seconds() - start) / rounds;
+
+    printf("%10ld records | filtered count AoS %8.2f ms (%6.2f GB/s touched) | SoA %8.2f ms | speedup %.1fx\n",
+           n, aosTime * 1e3, n * sizeof(Record) / aosTime / 1e9, soaTime * 1e3, aosTime / soaTime);
+    if(aos != soa){
+        fprintf(stderr, "Error: AoS and SoA counts differ.\n");
+    }
+    db_free(&db);
+}
+
+/*
+ * @return resident set size of this process in bytes
+ */
+long resident_bytes(){
+    long pages = 0;
+    long resident = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+    if(file != NULL){
+        if(fscanf(file, "%ld %ld", &pages, &resident) != 2){
+            resident = 0;
+        }
+        fclose(file);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * reports how much memory a table of n records takes, records, index and strings together
+ * @param long n number of records to put in the database
+ */
+void bench_memory(long n){
+    long before = resident_bytes();
+    Database db = db_create();
+    Record record;
+    for(long i = 0; i < n; i++){
+        make_record(&record, i);
+        db_append(&db, &record);
+    }
+    long after = resident_bytes();
+
+    printf("%10ld records | sizeof(Record) %3zu | resident %8.1f MB | %6.1f bytes per record | comment text %8.1f KB\n",
+           n, sizeof(Record), (after - before) / 1e6, (double)(after - before) / n, db.strings.bytes / 1e3);
+    db_free(&db);
+}
+
+/*
+ * one thread of the sharded update benchmark
+ */
+typedef struct UpdateWorker {
+    ShardedDatabase *sdb;
+    long n; //handles @user0 .. @user<n - 1> exist
+    long ops;
+    unsigned int seed;
+    long missed;
+} UpdateWorker;
+
+void *update_worker(void *arg){
+    UpdateWorker *worker = arg;
+    char handle[32];
+
+    for(long i = 0; i < worker->ops; i++){
+        snprintf(handle, sizeof(handle), "@user%ld", rand_r(&worker->seed) % worker->n);
+        worker->missed += !sharded_update(worker->sdb, handle, (unsigned long)i, "updated", 1700000000 + (unsigned long)i);
+    }
+    return NULL;
+}
+
+/*
+ * spreads 'ops' updates over 'threads' threads
+ * @return updates per second
+ */
+double run_updates(ShardedDatabase *sdb, long n, int threads, long ops){
+    UpdateWorker workers[threads];
+    pthread_t ids[threads];
+    long missed = 0;
+
+    double start = now_seconds();
+    for(int i = 0; i < threads; i++){
+        workers[i] = (UpdateWorker){ sdb, n, ops / threads, 7 + i, 0 };
+        pthread_create(&ids[i], NULL, update_worker, &workers[i]);
+    }
+    for(int i = 0; i < threads; i++){
+        pthread_join(ids[i], NULL);
+        missed += workers[i].missed;
+    }
+    double elapsed = now_seconds() - start;
+
+    if(missed != 0){
+        fprintf(stderr, "Error: %ld updates missed their record.\n", missed);
+    }
+    return ops / threads * threads / elapsed;
+}
+
+/*
+ * multithreaded update throughput with one lock over the whole table against BENCH_SHARDS shards
+ * an experiment on bench_sharded.c alone: igdb and the server still write under one lock
+ * @param long n number of records in the table
+ */
+void bench_shards(long n){
+    ShardedDatabase single = sharded_create(1);
+    ShardedDatabase sharded = sharded_create(BENCH_SHARDS);
+    Record record;
+    long ops = 2000000;
+
+    for(long i = 0; i < n; i++){
+        make_record(&record, i);
+        sharded_add(&single, &record);
+        sharded_add(&sharded, &record);
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threadCounts[] = {1, 2, 4, 8, (int)cpus};
+    double singleBase = 0, shardedBase = 0;
+    for(int i = 0; i < 5; i++){
+        if(i == 4 && cpus <= 8){
+            break;
+        }
+        double singleRate = run_updates(&single, n, threadCounts[i], ops);
+        double shardedRate = run_updates(&sharded, n, threadCounts[i], ops);
+        if(i == 0){
+            singleBase = singleRate;
+            shardedBase = shardedRate;
+        }
+        printf("%10ld records %3d threads | one lock %10.0f updates/s (%.2fx) | %d shards %10.0f updates/s (%.2fx)\n",
+               n, threadCounts[i], singleRate, singleRate / singleBase, BENCH_SHARDS, shardedRate, shardedRate / shardedBase);
+    }
+
+    if(sharded_size(&sharded) != n || sharded_size(&single) != n){
+        fprintf(stderr, "Error: shards lost records.\n");
+    }
+    sharded_free(&single);
+    sharded_free(&sharded);
+}
+
+/*
+ * times the main operations on a synthetic database.csv of n rows and prints them as one JSON object
+ * fast operations are repeated so that every figure covers at least about a million records
+ * @param long n number of rows in the generated file
+ */
+void bench_suite(long n){
+    static int first = 1;
+    char path[64];
+    char handle[32];
+    struct stat st;
+    long repeat = n < 1000000 ? 1000000 / n : 1;
+
+    snprintf(path, sizeof(path), "/tmp/igdb_bench_%ld.csv", n);
+    make_csv(path, n);
+    stat(path, &st);
+
+    //db_load_csv
+    Database db = db_create();
+    double start = now_seconds();
+    for(long r = 0; r < repeat; r++){
+        db_free(&db);
+        db = db_create();
+        db_load_csv(&db, path);
+    }
+    double load = (now_seconds() - start) / repeat;
+
+    //db_write_csv
+    start = now_seconds();
+    for(long r = 0; r < repeat; r++){
+        db_write_csv(&db, path);
+    }
+    double write = (now_seconds() - start) / repeat;
+
+    //db_lookup hit and miss
+    long lookups = 1000000;
+    long found = 0;
+    start = now_seconds();
+    for(long i = 0; i < lookups; i++){
+        snprintf(handle, sizeof(handle), "@user%ld", (i * 104729) % n);
+        found += db_lookup(&db, handle) != NULL;
+    }
+    double hit = (now_seconds() - start) / lookups;
+    start = now_seconds();
+    for(long i = 0; i < lookups; i++){
+        snprintf(handle, sizeof(handle), "@missing%ld", i);
+        found += db_lookup(&db, handle) != NULL;
+    }
+    double miss = (now_seconds() - start) / lookups;
+    if(found != lookups){
+        fprintf(stderr, "Error: lookups found %ld of %ld records.\n", found, lookups);
+    }
+
+    //db_list rendering, header and rows, to /dev/null
+    int fd = open("/dev/null", O_WRONLY);
+    start = now_seconds();
+    for(long r = 0; r < repeat; r++){
+        OutBuf out;
+        out_open(&out, fd);
+        out_list_header(&out);
+        for(int i = 0; i < db.size; i++){
+            out_list_record(&out, &db.records[i]);
+        }
+        out_close(&out);
+    }
+    double list = (now_seconds() - start) / repeat;
+    close(fd);
+    db_free(&db);
+
+    //bulk db_append into an empty database
+    Record record;
+    start = now_seconds();
+    for(long r = 0; r < repeat; r++){
+        Database fresh = db_create();
+        for(long i = 0; i < n; i++){
+            make_record(&record, i);
+            db_append(&fresh, &record);
+        }
+        db_free(&fresh);
+    }
+    double append = (now_seconds() - start) / repeat;
+    unlink(path);
+
+    printf("%s\n    {\"rows\": %ld, \"csv_bytes\": %ld, \"repeat\": %ld,\n", first ? "" : ",", n, (long)st.st_size, repeat);
+    printf("     \"load_csv_s\": %.6f, \"load_csv_mb_per_s\": %.1f,\n", load, st.st_size / load / 1e6);
+    printf("     \"write_csv_s\": %.6f, \"write_csv_mb_per_s\": %.1f,\n", write, st.st_size / write / 1e6);
+    printf("     \"lookup_hit_ns\": %.1f, \"lookup_miss_ns\": %.1f,\n", hit * 1e9, miss * 1e9);
+    printf("     \"append_s\": %.6f, \"append_ns_per_record\": %.1f,\n", append, append / n * 1e9);
+    printf("     \"list_s\": %.6f, \"list_ns_per_record\": %.1f}", list, list / n * 1e9);
+    fflush(stdout);
+    first = 0;
+}
+
+/*
+ * times find and grep through the handle indexes against a scan with strncmp and strstr,
+ * and appends with both indexes kept up to date
+ * @param long n number of records in the table
+ */
+void bench_search(long n){
+    Database db = db_create();
+    Record record;
+    for(long i = 0; i < n; i++){
+        make_record(&record, i);
+        db_append(&db, &record);
+    }
+
+    double start = now_seconds();
+    db_prefix_index(&db);
+    double prefixBuild = now_seconds() - start;
+    start = now_seconds();
+    db_trigram_index(&db);
+    double trigramBuild = now_seconds() - start;
+
+    //patterns are picked from existing handles so each query has a few matches
+    //the first ten queries are repeated as scans and must find the same number of records
+    int queries = 1000;
+    char pattern[32];
+    long scanned = 0, indexed = 0;
+    int *ids;
+    start = now_seconds();
+    for(int q = 0; q < queries; q++){
+        snprintf(pattern, sizeof(pattern), "@user%ld", (q * 7919L) % n);
+        int found = db_find_prefix(&db, pattern, &ids);
+        indexed += q < 10 ? found : 0;
+        free(ids);
+    }
+    double find = (now_seconds() - start) / queries;
+    start = now_seconds();
+    for(int q = 0; q < 10; q++){
+        snprintf(pattern, sizeof(pattern), "@user%ld", (q * 7919L) % n);
+        size_t length = strlen(pattern);
+        for(int i = 0; i < db.size; i++){
+            scanned += strncmp(db.records[i].handle, pattern, length) == 0;
+        }
+    }
+    double findScan = (now_seconds() - start) / 10;
+
+    start = now_seconds();
+    for(int q = 0; q < queries; q++){
+        snprintf(pattern, sizeof(pattern), "er%ld", (q * 7919L) % n);
+        int found = db_grep_handles(&db, pattern, &ids);
+        indexed += q < 10 ? found : 0;
+        free(ids);
+    }
+    double grep = (now_seconds() - start) / queries;
+    start = now_seconds();
+    for(int q = 0; q < 10; q++){
+        snprintf(pattern, sizeof(pattern), "er%ld", (q * 7919L) % n);
+        for(int i = 0; i < db.size; i++){
+            scanned += strstr(db.records[i].handle, pattern) != NULL;
+        }
+    }
+    double grepScan = (now_seconds() - start) / 10;
+
+    long extra = n / 10 + 1;
+    start = now_seconds();
+    for(long i = n; i < n + extra; i++){
+        make_record(&record, i);
+        db_append(&db, &record);
+    }
+    double append = (now_seconds() - start) / extra;
+
+    printf("%10ld records | build: prefix %8.3f s, trigram %8.3f s | find: %9.1f us (scan %9.1f us) | grep: %9.1f us (scan %9.1f us) | append %6.0f ns%s\n",
+           n, prefixBuild, trigramBuild, find * 1e6, findScan * 1e6, grep * 1e6, grepScan * 1e6, append * 1e9,
+           indexed == scanned ? "" : " MISMATCH");
+    db_free(&db);
+}
+
+/*
+ * deletes every other record in a shuffled order with the followers index built, timing the slowest single delete;
+ * deletes include the compaction steps, so the slowest one shows the pause compaction adds
+ * @param long n number of records in the table
+ */
+void bench_delete(long n){
+    Database db = db_create();
+    Record record;
+    for(long i = 0; i < n; i++){
+        make_record(&record, i);
+        db_append(&db, &record);
+    }
+    db_followers_index(&db);
+
+    long *order = malloc((n / 2 + 1) * sizeof(long));
+    if(order == NULL){
+        fprintf(stderr, "Failed memory allocation.\n");
+        exit(1);
+    }
+    for(long i = 0; i < n / 2; i++){
+        order[i] = i * 2;
+    }
+    srand(1);
+    for(long i = n / 2 - 1; i > 0; i--){
+        long j = rand() % (i + 1);
+        long t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    double slowest = 0;
+    long slow = 0;
+    double start = now_seconds();
+    for(long i = 0; i < n / 2; i++){
+        make_record(&record, order[i]);
+        double before = now_seconds();
+        db_remove(&db, record.handle);
+        double took = now_seconds() - before;
+        slowest = took > slowest ? took : slowest;
+        slow += took > 1e-3;
+    }
+    double total = now_seconds() - start;
+
+    printf("%10ld records | %ld deletes %8.3f s, %6.0f ns each | slowest %8.1f us, %ld over 1 ms | %d left, capacity %d\n",
+           n, n / 2, total, total / (n / 2) * 1e9, slowest * 1e6, slow, db_live_records(&db), db.capacity);
+    free(order);
+    db_free(&db);
+}
+
+/*
+ * sums and extremes with a plain loop over the records, the baseline for aggregate_records
+ */
+void reference_aggregate(Database const *db, Aggregate *result){
+    memset(result, 0, sizeof(*result));
+    result->followerMin = ULONG_MAX;
+    result->dateMin = ULONG_MAX;
+    for(int i = 0; i < db->size; i++){
+        Record const *record = &db->records[i];
+        result->count++;
+        result->followerSum += record->followerCount;
+        result->followerMin = record->followerCount < result->followerMin ? record->followerCount : result->followerMin;
+        result->followerMax = record->followerCount > result->followerMax ? record->followerCount : result->followerMax;
+        result->dateMin = record->dateLastModified < result->dateMin ? record->dateLastModified : result->dateMin;
+        result->dateMax = record->dateLastModified > result->dateMax ? record->dateLastModified : result->dateMax;
+    }
+}
+
+/*
+ * times the follower and date summary with a scalar loop over the records, the vector kernel on the records and
+ * on the columns with one thread, and the columns on every CPU; also times a 100 bucket histogram
+ * @param long n number of records in the table
+ */
+void bench_aggregate(long n){
+    Database db = db_create();
+    Record record;
+    db_reserve(&db, (int)n);
+    for(long i = 0; i < n; i++){
+        make_record(&record, i);
+        db_append(&db, &record);
+    }
+
+    int rounds = 10;
+    Aggregate expected, result;
+    int same = 1;
+    double start = now_seconds();
+    for(int r = 0; r < rounds; r++){
+        reference_aggregate(&db, &expected);
+    }
+    double scalar = (now_seconds() - start) / rounds;
+
+    double times[3];
+    for(int variant = 0; variant < 3; variant++){
+        if(variant == 1){
+            db_enable_columns(&db);
+        }
+        start = now_seconds();
+        for(int r = 0; r < rounds; r++){
+            aggregate_records(&db, &result, variant < 2 ? 1 : 0);
+        }
+        times[variant] = (now_seconds() - start) / rounds;
+        same &= result.count == expected.count && result.followerSum == expected.followerSum
+                && result.followerMin == expected.followerMin && result.followerMax == expected.followerMax
+                && result.dateMin == expected.dateMin && result.dateMax == expected.dateMax;
+    }
+
+    long counts[100];
+    start = now_seconds();
+    for(int r = 0; r < rounds; r++){
+        aggregate_histogram(&db, expected.followerMin, (expected.followerMax - expected.followerMin) / 100 + 1, 100, counts, 0);
+    }
+    double histogram = (now_seconds() - start) / rounds;
+    long total = 0;
+    for(int b = 0; b < 100; b++){
+        total += counts[b];
+    }
+
+    printf("%10ld records | scalar %8.2f ms | vector AoS %8.2f ms | vector SoA %8.2f ms | SoA threaded %8.2f ms | histogram %8.2f ms%s\n",
+           n, scalar * 1e3, times[0] * 1e3, times[1] * 1e3, times[2] * 1e3, histogram * 1e3,
+           same && total == n ? "" : " MISMATCH");
+    db_free(&db);
+}
+
+/*
+ * merges a dump of n / 2 rows, half of them handles already in the table, into a table of n records,
+ * with merge_csv and with a db_lookup per row, and checks both give the same table
+ * every other existing handle in the dump is newer than the table, the rest are older; the dump is shuffled
+ * @param long n number of records in the table
+ */
+void bench_merge(long n){
+    char path[] = "/tmp/igdb-bench-merge.csv";
+    Database dump = db_create();
+    Record record;
+    long *order = malloc((n / 2 + 1) * sizeof(long));
+    if(order == NULL){
+        fprintf(stderr, "Failed memory allocation.\n");
+        exit(1);
+    }
+    for(long i = 0; i < n / 2; i++){
+        order[i] = i;
+    }
+    srand(1);
+    for(long i = n / 2 - 1; i > 0; i--){ //a partner dump is in no particular order
+        long j = rand() % (i + 1);
+        long t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for(long k = 0; k < n / 2; k++){
+        long i = order[k];
+        long id = i % 2 == 0 ? i : n + i; //even rows update existing handles, odd rows add new ones
+        make_record(&record, id);
+        record.followerCount += 1;
+        record.dateLastModified += i % 4 == 0 ? 1 : -1;
+        db_append(&dump, &record);
+    }
+    db_write_csv(&dump, path);
+    db_free(&dump);
+    free(order);
+
+    Database merged = db_create();
+    Database looped = db_create();
+    for(long i = 0; i < n; i++){
+        make_record(&record, i);
+        db_append(&merged, &record);
+        db_append(&looped, &record);
+    }
+
+    MergeResult result;
+    double start = now_seconds();
+    merge_csv(&merged, path, 1, &result);
+    double merge = now_seconds() - start;
+
+    start = now_seconds();
+    Database incoming = db_create();
+    db_load_csv(&incoming, path);
+    for(int i = 0; i < incoming.size; i++){
+        Record *row = &incoming.records[i];
+        Record *existing = db_lookup(&looped, row->handle);
+        if(existing == NULL){
+            db_append(&looped, row);
+        }else if(row->dateLastModified > existing->dateLastModified){
+            db_update_record(&looped, existing, row->followerCount, row->comment, row->dateLastModified);
+        }
+    }
+    db_free(&incoming);
+    double loop = now_seconds() - start;
+    unlink(path);
+
+    printf("%10ld records | merge %ld rows: %8.3f s (lookup loop %8.3f s) | %ld added, %ld updated, %ld kept%s\n",
+           n, result.rows, merge, loop, result.added, result.updated, result.kept,
+           same_records(&merged, &looped) ? "" : " MISMATCH");
+    db_free(&merged);
+    db_free(&looped);
+}
+
+/*
+ * @return size of the file at 'path' in bytes, 0 if it does not exist
+ */
+long file_bytes(char const *path){
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : 0;
+}
+
+/*
+ * saves and loads a table of n records as plain and as compressed CSV, reporting wall time and bytes on disk,
+ * and checks that the compressed file loads back to the same table
+ * @param long n number of records in the table
+ */
+void bench_codec(long n){
+    char plainPath[] = "/tmp/igdb-bench-codec.csv";
+    char packedPath[] = "/tmp/igdb-bench-codec.csv.z";
+    Database db = db_create();
+    Record record;
+    for(long i = 0; i < n; i++){
+        make_record(&record, i);
+        db_append(&db, &record);
+    }
+
+    double start = now_seconds();
+    db_write_csv(&db, plainPath);
+    double plainSave = now_seconds() - start;
+    start = now_seconds();
+    db_write_csv_compressed(&db, packedPath);
+    double packedSave = now_seconds() - start;
+
+    Database plain = db_create();
+    start = now_seconds();
+    db_load_csv(&plain, plainPath);
+    double plainLoad = now_seconds() - start;
+    Database packed = db_create();
+    start = now_seconds();
+    db_load_csv(&packed, packedPath);
+    double packedLoad = now_seconds() - start;
+
+    long plainBytes = file_bytes(plainPath);
+    long packedBytes = file_bytes(packedPath);
+    printf("%10ld records | plain: save %7.3f s, load %7.3f s, %11ld bytes | compressed: save %7.3f s, load %7.3f s, %11ld bytes (%.1f%%)%s\n",
+           n, plainSave, plainLoad, plainBytes, packedSave, packedLoad, packedBytes,
+           plainBytes > 0 ? 100.0 * packedBytes / plainBytes : 0.0, same_records(&db, &packed) && same_records(&db, &plain) ? "" : " MISMATCH");
+    unlink(plainPath);
+    unlink(packedPath);
+    db_free(&plain);
+    db_free(&packed);
+    db_free(&db);
+}
+
+/*
+ * usage: bench MODE [N...]
+ * lookup: hash index against a linear scan, defaults to 10k, 1M and 10M records
+ * load: db_load_csv and db_load_csv_parallel against the getline loader, defaults to 10k, 1M and 10M records
+ * snapshot: startup from a snapshot against startup from CSV, same defaults
+ * output: list and CSV rendering with stdio against the output engine, same defaults
+ * scan: filtered count over followerCount in AoS and SoA layout, same defaults
+ * memory: resident memory of a table built with db_append, same defaults
+ * shards: multithreaded updates on one lock against a sharded table, an experiment outside igdb, same defaults
+ * search: find and grep through the handle indexes against a scan, same defaults
+ * delete: deletes half the table, reporting the slowest delete including compaction, same defaults
+ * merge: merging a dump of half the table's size against a lookup per row, same defaults
+ * codec: save and load wall time and file size, plain CSV against block compressed CSV, same defaults
+ * aggregate: follower and date summary with a scalar loop against the vector kernel and its threaded path, same defaults
+ * suite: load, write, lookup, append and list timings as JSON, defaults to 1k, 100k, 1M and 10M rows
+ */
+int main(int argc, char **argv){
+    void (*run)(long) = NULL;
+
+    if(argc >= 2 && strcmp(argv[1], "lookup") == 0){
+        run = bench_lookup;
+    }else if(argc >= 2 && strcmp(argv[1], "load") == 0){
+        run = bench_load;
+    }else if(argc >= 2 && strcmp(argv[1], "snapshot") == 0){
+        run = bench_snapshot;
+    }else if(argc >= 2 && strcmp(argv[1], "output") == 0){
+        run = bench_output;
+    }else if(argc >= 2 && strcmp(argv[1], "scan") == 0){
+        run = bench_scan;
+    }else if(argc >= 2 && strcmp(argv[1], "memory") == 0){
+        run = bench_memory;
+    }else if(argc >= 2 && strcmp(argv[1], "shards") == 0){
+        run = bench_shards;
+    }else if(argc >= 2 && strcmp(argv[1], "search") == 0){
+        run = bench_search;
+    }else if(argc >= 2 && strcmp(argv[1], "delete") == 0){
+        run = bench_delete;
+    }else if(argc >= 2 && strcmp(argv[1], "merge") == 0){
+        run = bench_merge;
+    }else if(argc >= 2 && strcmp(argv[1], "codec") == 0){
+        run = bench_codec;
+    }else if(argc >= 2 && strcmp(argv[1], "aggregate") == 0){
+        run = bench_aggregate;
+    }else if(argc >= 2 && strcmp(argv[1], "suite") == 0){
+        run = bench_suite;
+    }else{
+        fprintf(stderr, "usage: %s lookup|load|snapshot|output|scan|memory|shards|search|delete|merge|codec|aggregate|suite [N...]\n", argv[0]);
+        return 1;
+    }
+
+    if(run == bench_suite){
+        printf("{\"compiler\": \"%s\", \"timestamp\": %ld, \"results\": [", __VERSION__, (long)time(NULL));
+        if(argc == 2){
+            long sizes[] = {1000, 100000, 1000000, 10000000};
+            for(int i = 0; i < 4; i++){
+                run(sizes[i]);
+            }
+        }
+        for(int i = 2; i < argc; i++){
+            run(atol(argv[i]));
+        }
+        printf("\n]}\n");
+    }else if(argc == 2){
+        long sizes[] = {10000, 1000000, 10000000};
+        for(int i = 0; i < 3; i++){
+            run(sizes[i]);
+        }
+    }else{
+        for(int i = 2; i < argc; i++){
+            run(atol(argv[i]));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bench_sharded.h"
+#include "output.h"
+
+/*
+ * @param int count number of shards, at least 1
+ */
+ShardedDatabase sharded_create(int count){
+	ShardedDatabase sdb;
+
+	if(count < 1){
+		count = 1;
+	}
+	sdb.count = count;
+	if(posix_memalign((void **)&sdb.shards, 64, count * sizeof(Shard)) != 0){
+		fprintf(stderr, "Failed to allocate memory for shards.\n");
+		exit(1);
+	}
+	for(int i = 0; i < count; i++){
+		pthread_mutex_init(&sdb.shards[i].lock, NULL);
+		sdb.shards[i].db = db_create();
+	}
+	return sdb;
+}
+
+void sharded_free(ShardedDatabase *sdb){
+	for(int i = 0; i < sdb->count; i++){
+		db_free(&sdb->shards[i].db);
+		pthread_mutex_destroy(&sdb->shards[i].lock);
+	}
+	free(sdb->shards);
+	sdb->shards = NULL;
+	sdb->count = 0;
+}
+
+/*
+ * @return the shard that holds 'handle'
+ * the shard is picked from the high bits of the hash; each shard's own index probes with the low bits,
+ * so a record's shard says nothing about where it lands in that index
+ */
+int sharded_shard_of(ShardedDatabase const *sdb, char const *handle){
+	return (int)(((unsigned long)db_hash(handle) * (unsigned long)sdb->count) >> 32);
+}
+
+/*
+ * appends a copy of 'item' to its shard unless the handle is already there
+ * @return 1 if the record was added, 0 if the handle exists
+ */
+int sharded_add(ShardedDatabase *sdb, Record const *item){
+	Shard *shard = &sdb->shards[sharded_shard_of(sdb, item->handle)];
+	int added = 0;
+
+	pthread_mutex_lock(&shard->lock);
+	if(db_lookup(&shard->db, item->handle) == NULL){
+		db_append(&shard->db, item);
+		added = 1;
+	}
+	pthread_mutex_unlock(&shard->lock);
+	return added;
+}
+
+/*
+ * same as db_update_record on the record with 'handle'
+ * @return 1 if the record was updated, 0 if there is no such handle
+ */
+int sharded_update(ShardedDatabase *sdb, char const *handle, unsigned long followerCount, char const *comment, unsigned long dateLastModified){
+	Shard *shard = &sdb->shards[sharded_shard_of(sdb, handle)];
+
+	pthread_mutex_lock(&shard->lock);
+	Record *rec = db_lookup(&shard->db, handle);
+	if(rec != NULL){
+		db_update_record(&shard->db, rec, followerCount, comment, dateLastModified);
+	}
+	pthread_mutex_unlock(&shard->lock);
+	return rec != NULL;
+}
+
+/*
+ * copies the record with 'handle' out of its shard; the copy stays valid while other threads keep writing
+ * @param *comment buffer of COMMENT_SIZE characters that record->comment is pointed at
+ * @return 1 if the handle was found, 0 otherwise
+ */
+int sharded_get(ShardedDatabase *sdb, char const *handle, Record *record, char *comment){
+	Shard *shard = &sdb->shards[sharded_shard_of(sdb, handle)];
+
+	pthread_mutex_lock(&shard->lock);
+	Record *rec = db_lookup(&shard->db, handle);
+	if(rec != NULL){
+		*record = *rec;
+		strcpy(comment, rec->comment);
+		record->comment = comment;
+	}
+	pthread_mutex_unlock(&shard->lock);
+	return rec != NULL;
+}
+
+/*
+ * locks every shard, always in the same order so two whole-table operations cannot deadlock
+ */
+static void lock_all(ShardedDatabase *sdb){
+	for(int i = 0; i < sdb->count; i++){
+		pthread_mutex_lock(&sdb->shards[i].lock);
+	}
+}
+
+static void unlock_all(ShardedDatabase *sdb){
+	for(int i = sdb->count - 1; i >= 0; i--){
+		pthread_mutex_unlock(&sdb->shards[i].lock);
+	}
+}
+
+/*
+ * @return number of records over all shards
+ */
+long sharded_size(ShardedDatabase *sdb){
+	long size = 0;
+
+	lock_all(sdb);
+	for(int i = 0; i < sdb->count; i++){
+		size += sdb->shards[i].db.size;
+	}
+	unlock_all(sdb);
+	return size;
+}
+
+/*
+ * appends the records of the CSV file at 'path' to their shards, in file order
+ * as with db_load_csv, the first of several records with the same handle is the one lookups find
+ */
+void sharded_load_csv(ShardedDatabase *sdb, char const *path){
+	Database scratch = db_create();
+
+	db_load_csv(&scratch, path);
+
+	//count first so every shard is sized once
+	int *counts = calloc(sdb->count, sizeof(int));
+	if(counts == NULL){
+		fprintf(stderr, "Failed memory allocation.\n");
+		exit(1);
+	}
+	for(int i = 0; i < scratch.size; i++){
+		counts[sharded_shard_of(sdb, scratch.records[i].handle)]++;
+	}
+
+	lock_all(sdb);
+	for(int i = 0; i < sdb->count; i++){
+		db_reserve(&sdb->shards[i].db, counts[i]);
+	}
+	for(int i = 0; i < scratch.size; i++){
+		Record const *record = &scratch.records[i];
+		db_append(&sdb->shards[sharded_shard_of(sdb, record->handle)].db, record);
+	}
+	unlock_all(sdb);
+
+	free(counts);
+	db_free(&scratch);
+}
+
+/*
+ * writes the list table to fd, the same rows db_list prints for a database holding the shards one after another
+ * @param offset number of records to skip
+ * @param limit maximum number of records to print
+ */
+void sharded_list(ShardedDatabase *sdb, int fd, unsigned long offset, unsigned long limit){
+	OutBuf out;
+	unsigned long position = 0;
+
+	out_open(&out, fd);
+	out_list_header(&out);
+	lock_all(sdb);
+	for(int i = 0; i < sdb->count; i++){
+		Database *db = &sdb->shards[i].db;
+		int j = 0;
+		if(position + db->size <= offset){ //the whole shard is skipped
+			position += db->size;
+			continue;
+		}
+		if(position < offset){
+			j = offset - position;
+			position = offset;
+		}
+		for(; j < db->size && position - offset < limit; j++, position++){
+			out_list_record(&out, &db->records[j]);
+		}
+	}
+	unlock_all(sdb);
+	out_close(&out);
+}
+
+/*
+ * overwrites the file at 'path' with every record in CSV format, shard by shard
+ * @return 1 on success, 0 if the file could not be written
+ */
+int sharded_write_csv(ShardedDatabase *sdb, char const *path){
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(fd == -1){
+		fprintf(stderr, "Error: unable to open or create file '%s'.\n", path);
+		return 0;
+	}
+
+	OutBuf out;
+	out_open(&out, fd);
+	lock_all(sdb);
+	for(int i = 0; i < sdb->count; i++){
+		Database *db = &sdb->shards[i].db;
+		for(int j = 0; j < db->size; j++){
+			out_csv_record(&out, &db->records[j]);
+		}
+	}
+	unlock_all(sdb);
+
+	int ok = out_close(&out);
+	ok = fsync(fd) == 0 && ok;
+	ok = close(fd) == 0 && ok;
+	if(!ok){
+		fprintf(stderr, "Error: failed to write '%s'.\n", path);
+	}
+	return ok;
+}
+
+/*
+ * replaces the CSV file at 'path' atomically: it is written under a temporary name and renamed into place
+ * @return 1 on success, 0 on failure
+ */
+int sharded_save(ShardedDatabase *sdb, char const *path){
+	char *tmpPath = malloc(strlen(path) + sizeof(".tmp"));
+	if(tmpPath == NULL){
+		fprintf(stderr, "Failed memory allocation.\n");
+		exit(1);
+	}
+	sprintf(tmpPath, "%s.tmp", path);
+
+	int ok = sharded_write_csv(sdb, tmpPath);
+	if(ok && rename(tmpPath, path) != 0){
+		fprintf(stderr, "Error: unable to replace '%s'.\n", path);
+		ok = 0;
+	}
+	if(!ok){
+		unlink(tmpPath);
+	}
+	free(tmpPath);
+	return ok;
+}
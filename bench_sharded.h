@@ -0,0 +1,49 @@
+#ifndef BENCH_SHARDED_H
+#define BENCH_SHARDED_H
+
+#include <pthread.h>
+#include "database.h"
+
+/*
+ * one partition of a ShardedDatabase, padded to a cache line so neighbouring locks do not share one
+ */
+typedef struct Shard {
+ pthread_mutex_t lock; //held for every access to db
+ Database db;
+} __attribute__((aligned(64))) Shard;
+
+/*
+ * records partitioned by a hash of their handle over independent databases,
+ * so writers on different shards never wait for each other
+ * whole-table operations visit the shards in order and each shard in insertion order
+ * EXPERIMENT: only "bench shards" uses it, to measure how update throughput could scale with the lock split;
+ * igdb and the server keep one Database behind one lock, so their writes do not scale with cores
+ */
+typedef struct ShardedDatabase {
+ Shard *shards;
+ int count;
+} ShardedDatabase;
+
+ShardedDatabase sharded_create(int count);
+
+void sharded_free(ShardedDatabase * sdb);
+
+int sharded_shard_of(ShardedDatabase const * sdb, char const * handle);
+
+int sharded_add(ShardedDatabase * sdb, Record const * item);
+
+int sharded_update(ShardedDatabase * sdb, char const * handle, unsigned long followerCount, char const * comment, unsigned long dateLastModified);
+
+int sharded_get(ShardedDatabase * sdb, char const * handle, Record * record, char * comment);
+
+long sharded_size(ShardedDatabase * sdb);
+
+void sharded_load_csv(ShardedDatabase * sdb, char const * path);
+
+void sharded_list(ShardedDatabase * sdb, int fd, unsigned long offset, unsigned long limit);
+
+int sharded_write_csv(ShardedDatabase * sdb, char const * path);
+
+int sharded_save(ShardedDatabase * sdb, char const * path);
+
+#endif
@@ -0,0 +1,408 @@
+#define _GNU_SOURCE //F_SETPIPE_SZ
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "codec.h"
+
+//shortest match worth a sequence; shorter ones cost more than the literals they replace
+#define CODEC_MIN_MATCH 4
+//furthest back a match can start, the largest two byte offset
+#define CODEC_MAX_OFFSET 65535
+//the match finder remembers the last position of 2^CODEC_HASH_BITS hashes of four bytes
+#define CODEC_HASH_BITS 14
+//top bit of a block's stored length, set for blocks kept as is
+#define CODEC_STORED 0x80000000u
+#define CODEC_HEADER_SIZE 8
+
+static unsigned int read32(char const *p){
+	unsigned int value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static unsigned int hash4(unsigned int value){
+	return (value * 2654435761u) >> (32 - CODEC_HASH_BITS);
+}
+
+static void put_le32(char *p, unsigned int value){
+	for(int i = 0; i < 4; i++){
+		p[i] = (char)(value >> (8 * i));
+	}
+}
+
+static unsigned int get_le32(char const *p){
+	unsigned int value = 0;
+	for(int i = 0; i < 4; i++){
+		value |= (unsigned int)(unsigned char)p[i] << (8 * i);
+	}
+	return value;
+}
+
+/*
+ * @return the largest size codec_compress can produce for 'length' bytes
+ */
+size_t codec_bound(size_t length){
+	return length + length / 255 + 16;
+}
+
+/*
+ * writes the part of a length that did not fit in its four bits of the token, as a run of 255s and a final smaller byte
+ */
+static char *put_length(char *out, size_t length){
+	while(length >= 255){
+		*out++ = (char)255;
+		length -= 255;
+	}
+	*out++ = (char)length;
+	return out;
+}
+
+/*
+ * writes one sequence: 'literalCount' bytes copied as they are, then a match of 'matchLength' bytes 'offset' back
+ * @param size_t matchLength 0 for the last sequence of a block, which has no match
+ */
+static char *put_sequence(char *out, char const *literals, size_t literalCount, size_t offset, size_t matchLength){
+	size_t matchCode = matchLength >= CODEC_MIN_MATCH ? matchLength - CODEC_MIN_MATCH : 0;
+	unsigned char token = (literalCount < 15 ? literalCount : 15) << 4;
+	if(matchLength > 0){
+		token |= matchCode < 15 ? matchCode : 15;
+	}
+	*out++ = (char)token;
+	if(literalCount >= 15){
+		out = put_length(out, literalCount - 15);
+	}
+	memcpy(out, literals, literalCount);
+	out += literalCount;
+	if(matchLength > 0){
+		*out++ = (char)(offset & 0xff);
+		*out++ = (char)(offset >> 8);
+		if(matchCode >= 15){
+			out = put_length(out, matchCode - 15);
+		}
+	}
+	return out;
+}
+
+/*
+ * compresses 'length' bytes with greedy LZ77 matching on a hash of the next four bytes
+ * @param *dst room for codec_bound(length) bytes
+ * @return the compressed size
+ */
+size_t codec_compress(char const *src, size_t length, char *dst){
+	unsigned int table[1 << CODEC_HASH_BITS]; //position + 1 of the last occurrence of each hash, 0 for none
+	size_t ip = 0;
+	size_t anchor = 0; //first byte not yet written
+	char *out = dst;
+
+	memset(table, 0, sizeof(table));
+	if(length >= CODEC_MIN_MATCH){
+		size_t limit = length - CODEC_MIN_MATCH; //last position four bytes can be read from
+		while(ip <= limit){
+			unsigned int sequence = read32(src + ip);
+			unsigned int hash = hash4(sequence);
+			size_t ref = table[hash];
+			table[hash] = ip + 1;
+			if(ref == 0 || ip - (ref - 1) > CODEC_MAX_OFFSET || read32(src + ref - 1) != sequence){
+				ip += 1 + ((ip - anchor) >> 6); //step further through text that keeps not matching
+				continue;
+			}
+			ref--;
+			size_t match = CODEC_MIN_MATCH;
+			while(ip + match < length && src[ref + match] == src[ip + match]){
+				match++;
+			}
+			while(ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]){ //the match may start before the hashed bytes
+				ip--;
+				ref--;
+				match++;
+			}
+			out = put_sequence(out, src + anchor, ip - anchor, ip - ref, match);
+			ip += match;
+			anchor = ip;
+			if(ip + 2 <= length){
+				table[hash4(read32(src + ip - 2))] = ip - 2 + 1;
+			}
+		}
+	}
+	if(anchor < length){
+		out = put_sequence(out, src + anchor, length - anchor, 0, 0);
+	}
+	return out - dst;
+}
+
+/*
+ * reads the rest of a length whose four bits in the token were all set
+ * @return 1 on success, 0 if the input ends first or the length is larger than 'limit'
+ */
+static int get_length(unsigned char const **ip, unsigned char const *end, size_t limit, size_t *length){
+	unsigned char byte;
+	do{
+		if(*ip == end){
+			return 0;
+		}
+		byte = *(*ip)++;
+		*length += byte;
+		if(*length > limit){
+			return 0;
+		}
+	}while(byte == 255);
+	return 1;
+}
+
+/*
+ * decompresses a block made by codec_compress, checking every length and offset against the buffers
+ * @return the decompressed size, -1 if the input is corrupt or does not fit in 'capacity' bytes
+ */
+long codec_decompress(char const *src, size_t length, char *dst, size_t capacity){
+	unsigned char const *ip = (unsigned char const *)src;
+	unsigned char const *end = ip + length;
+	size_t op = 0;
+
+	while(ip < end){
+		unsigned int token = *ip++;
+		size_t literals = token >> 4;
+		if(literals == 15 && !get_length(&ip, end, capacity, &literals)){
+			return -1;
+		}
+		if((size_t)(end - ip) < literals || capacity - op < literals){
+			return -1;
+		}
+		memcpy(dst + op, ip, literals);
+		ip += literals;
+		op += literals;
+		if(ip == end){
+			break; //the last sequence has no match
+		}
+
+		if(end - ip < 2){
+			return -1;
+		}
+		size_t offset = ip[0] | (size_t)ip[1] << 8;
+		ip += 2;
+		size_t match = token & 15;
+		if(match == 15 && !get_length(&ip, end, capacity, &match)){
+			return -1;
+		}
+		match += CODEC_MIN_MATCH;
+		if(offset == 0 || offset > op || capacity - op < match){
+			return -1;
+		}
+		char *to = dst + op;
+		char const *from = to - offset;
+		if(offset >= match){
+			memcpy(to, from, match);
+		}else{
+			for(size_t i = 0; i < match; i++){ //overlapping copy repeats the last 'offset' bytes
+				to[i] = from[i];
+			}
+		}
+		op += match;
+	}
+	return (long)op;
+}
+
+/*
+ * @return 1 if the file open on 'fd' starts with CODEC_MAGIC
+ */
+int codec_detect(int fd){
+	char magic[CODEC_MAGIC_SIZE];
+	return pread(fd, magic, sizeof(magic), 0) == sizeof(magic) && memcmp(magic, CODEC_MAGIC, sizeof(magic)) == 0;
+}
+
+/*
+ * @return 1 if all 'length' bytes were written
+ */
+static int write_all(int fd, char const *data, size_t length){
+	while(length > 0){
+		ssize_t written = write(fd, data, length);
+		if(written == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			return 0;
+		}
+		data += written;
+		length -= written;
+	}
+	return 1;
+}
+
+/*
+ * reads until 'length' bytes arrived or the input ended
+ * @return the number of bytes read, -1 on a read error
+ */
+static ssize_t read_full(int fd, char *data, size_t length){
+	size_t done = 0;
+	while(done < length){
+		ssize_t got = read(fd, data + done, length - done);
+		if(got == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		if(got == 0){
+			break;
+		}
+		done += got;
+	}
+	return done;
+}
+
+static void *checked_malloc(size_t bytes){
+	void *ptr = malloc(bytes);
+	if(ptr == NULL){
+		fprintf(stderr, "Failed to allocate memory for compression.\n");
+		exit(1);
+	}
+	return ptr;
+}
+
+/*
+ * compression thread: cuts what arrives through the pipe into blocks, compresses them and writes them to the file
+ * keeps draining the pipe after a failed write so the writing side never blocks
+ */
+static void *compress_blocks(void *arg){
+	CodecStream *stream = arg;
+	char *block = checked_malloc(CODEC_BLOCK);
+	char *packed = checked_malloc(CODEC_HEADER_SIZE + codec_bound(CODEC_BLOCK));
+
+	if(!write_all(stream->fd, CODEC_MAGIC, CODEC_MAGIC_SIZE)){
+		stream->failed = 1;
+	}
+	for(;;){
+		ssize_t length = read_full(stream->threadPipe, block, CODEC_BLOCK);
+		if(length <= 0){
+			stream->failed |= length < 0;
+			break;
+		}
+		size_t stored = codec_compress(block, length, packed + CODEC_HEADER_SIZE);
+		unsigned int storedWord = stored;
+		if(stored >= (size_t)length){
+			memcpy(packed + CODEC_HEADER_SIZE, block, length);
+			stored = length;
+			storedWord = length | CODEC_STORED;
+		}
+		put_le32(packed, length);
+		put_le32(packed + 4, storedWord);
+		if(!stream->failed && !write_all(stream->fd, packed, CODEC_HEADER_SIZE + stored)){
+			stream->failed = 1;
+		}
+	}
+	memset(packed, 0, CODEC_HEADER_SIZE);
+	if(!stream->failed && !write_all(stream->fd, packed, CODEC_HEADER_SIZE)){
+		stream->failed = 1;
+	}
+	close(stream->threadPipe);
+	free(block);
+	free(packed);
+	return NULL;
+}
+
+/*
+ * decompression thread: reads blocks from the file and writes the text into the pipe
+ * stops at the end marker, or early with 'failed' set if the file is truncated or corrupt
+ */
+static void *decompress_blocks(void *arg){
+	CodecStream *stream = arg;
+	char *block = checked_malloc(CODEC_BLOCK);
+	char *packed = checked_malloc(codec_bound(CODEC_BLOCK));
+	char header[CODEC_HEADER_SIZE];
+
+	stream->failed = 1; //until the end marker is seen
+	while(read_full(stream->fd, header, sizeof(header)) == sizeof(header)){
+		unsigned int length = get_le32(header);
+		unsigned int storedWord = get_le32(header + 4);
+		size_t stored = storedWord & ~CODEC_STORED;
+		if(length == 0){
+			stream->failed = 0;
+			break;
+		}
+		if(length > CODEC_BLOCK || stored > codec_bound(CODEC_BLOCK)
+		   || ((storedWord & CODEC_STORED) && stored != length)
+		   || read_full(stream->fd, packed, stored) != (ssize_t)stored){
+			break;
+		}
+		char const *text = packed;
+		if(!(storedWord & CODEC_STORED)){
+			if(codec_decompress(packed, stored, block, CODEC_BLOCK) != (long)length){
+				break;
+			}
+			text = block;
+		}
+		if(!write_all(stream->threadPipe, text, length)){
+			break;
+		}
+	}
+	close(stream->threadPipe);
+	free(block);
+	free(packed);
+	return NULL;
+}
+
+/*
+ * creates the pipe and starts 'work' on its own thread
+ * @param int callerEnd 0 if the caller reads from the pipe, 1 if it writes to it
+ * @return the caller's end of the pipe, -1 on failure
+ */
+static int start_stream(CodecStream *stream, int fd, int callerEnd, void *(*work)(void *)){
+	int fds[2];
+	if(pipe(fds) != 0){
+		fprintf(stderr, "Error: unable to create a pipe for compression.\n");
+		return -1;
+	}
+	fcntl(fds[1], F_SETPIPE_SZ, CODEC_BLOCK); //best effort; a larger pipe means fewer switches between the threads
+	stream->fd = fd;
+	stream->pipe = fds[callerEnd];
+	stream->threadPipe = fds[1 - callerEnd];
+	stream->failed = 0;
+	if(pthread_create(&stream->thread, NULL, work, stream) != 0){
+		fprintf(stderr, "Error: unable to start the compression thread.\n");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	return stream->pipe;
+}
+
+/*
+ * starts compressing into the file open on 'fd'
+ * @return a descriptor to write the text to, -1 on failure; codec_writer_close closes it
+ */
+int codec_writer_open(CodecStream *stream, int fd){
+	return start_stream(stream, fd, 1, compress_blocks);
+}
+
+/*
+ * ends the text, waits for the last block to be written and stops the thread; 'fd' stays open
+ * @return 1 if the whole file was written, 0 otherwise
+ */
+int codec_writer_close(CodecStream *stream){
+	close(stream->pipe);
+	pthread_join(stream->thread, NULL);
+	return !stream->failed;
+}
+
+/*
+ * starts decompressing the file open on 'fd', which must start with CODEC_MAGIC
+ * @return a descriptor to read the text from until end of file, -1 on failure; codec_reader_close closes it
+ */
+int codec_reader_open(CodecStream *stream, int fd){
+	if(lseek(fd, CODEC_MAGIC_SIZE, SEEK_SET) == -1){
+		return -1;
+	}
+	return start_stream(stream, fd, 0, decompress_blocks);
+}
+
+/*
+ * stops the thread once the caller has read the text to its end; 'fd' stays open
+ * @return 1 if the whole file was read, 0 if it was truncated or corrupt
+ */
+int codec_reader_close(CodecStream *stream){
+	close(stream->pipe);
+	pthread_join(stream->thread, NULL);
+	return !stream->failed;
+}
@@ -0,0 +1,46 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * compressed file format: CODEC_MAGIC, then blocks of at most CODEC_BLOCK bytes of the original text, each a header of
+ * two little endian 32 bit words, the original length and the stored length, followed by the stored bytes
+ * the top bit of the stored length marks a block kept as is because it did not compress
+ * a header with an original length of 0 ends the file, so a truncated file is told apart from a complete one
+ * blocks are LZ77 coded: sequences of a token byte holding a literal count and a match length, the literals,
+ * and a two byte offset back into the block
+ */
+#define CODEC_MAGIC "IGZ1"
+#define CODEC_MAGIC_SIZE 4
+#define CODEC_BLOCK (1 << 20)
+
+/*
+ * a compressor or decompressor running on its own thread, connected to the caller through a pipe
+ */
+typedef struct CodecStream {
+ int fd; //the compressed file
+ int pipe; //the caller's end of the pipe: written by the caller when writing, read by the caller when reading
+ int threadPipe; //the thread's end of the pipe
+ pthread_t thread;
+ int failed; //set by the thread if the file could not be written or was corrupt
+} CodecStream;
+
+size_t codec_bound(size_t length);
+
+size_t codec_compress(char const * src, size_t length, char * dst);
+
+long codec_decompress(char const * src, size_t length, char * dst, size_t capacity);
+
+int codec_detect(int fd);
+
+int codec_writer_open(CodecStream * stream, int fd);
+
+int codec_writer_close(CodecStream * stream);
+
+int codec_reader_open(CodecStream * stream, int fd);
+
+int codec_reader_close(CodecStream * stream);
+
+#endif
@@ -2,7 +2,32 @@
 #include <stdlib.h>
 #include <string.h>
 #include "database.h"
+#include "output.h"
+#include "stats.h"
+#include "handleindex.h"
+#include "wordindex.h"
+#include "codec.h"
 #include <time.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <errno.h>
+
+//a CSV buffer's line count is estimated from LOAD_SAMPLES stretches of LOAD_SAMPLE_BYTES
+#define LOAD_SAMPLES 8
+#define LOAD_SAMPLE_BYTES (16 << 10)
+
+//compaction starts once more than one record in DB_COMPACT_RATIO is deleted
+#define DB_COMPACT_RATIO 4
+//records a compaction step looks at, which bounds the pause it adds to a command
+//moving one costs a few skip list operations when the sorted indexes exist, about a microsecond each
+#define DB_COMPACT_STEP 256
+//the comment arena is rebuilt once it holds this many more strings than twice the records, so at least half of its
+//strings belong to no record; updates and compaction leave the comments they replace behind until then
+#define DB_RECLAIM_SLACK 4096
 
 /* 
  * initializes Database
@@ -22,35 +47,274 @@ Database db_create() {
         exit(1);
     }
 
+    //the hash index starts with twice as many slots as records
+    db.indexCount = 0;
+    db.indexCapacity = 8;
+    db.index = (IndexSlot *)malloc(db.indexCapacity * sizeof(IndexSlot));
+    if (db.index == NULL) {
+        fprintf(stderr, "Failed to allocate memory for index.\n");
+        exit(1);
+    }
+    for (int i = 0; i < db.indexCapacity; i++) {
+        db.index[i].record = -1;
+    }
+
+    db.mapping = NULL;
+    db.mappingLength = 0;
+    db.byFollowers = NULL;
+    db.byDate = NULL;
+    db.followerColumn = NULL;
+    db.dateColumn = NULL;
+    arena_init(&db.strings);
+    db.byHandle = NULL;
+    db.trigrams = NULL;
+    db.words = NULL;
+    db.dead = NULL;
+    db.deadCount = 0;
+    db.compactFrom = -1;
+    db.compactTo = 0;
+
     return db;
 }
+
 /*
- * Copies the record pointed to by iten to the end of the database
- * @param *db pointer to database
- * @param *item pointer to item that will be appended to database
- *
+ * @param *handle string to hash
+ * @return 32 bit FNV-1a hash of the handle
  */
-void db_append(Database *db, const Record *item){
-	if(db->size == db->capacity){
-		int newCapacity = db->capacity*2;
-		Record *newRecords = (Record *)malloc(newCapacity * sizeof(Record));
-	
-		
+unsigned int db_hash(char const *handle){
+	unsigned int hash = 2166136261u;
+	while(*handle != '\0'){
+		hash ^= (unsigned char)*handle++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*
+ * Places record number 'record' into the first free slot of its probe sequence
+ * the caller has already checked that the handle is not in the index
+ */
+static void index_place(Database *db, unsigned int hash, int record){
+	unsigned int mask = db->indexCapacity - 1;
+	unsigned int slot = hash & mask;
+
+	while(db->index[slot].record != -1){ //linear probing
+		slot = (slot + 1) & mask;
+	}
+	db->index[slot].hash = hash;
+	db->index[slot].record = record;
+	db->indexCount++;
+}
+
+/*
+ * Moves the index to 'newCapacity' slots and reinserts every occupied slot
+ * @param int newCapacity power of two, at least twice the number of occupied slots
+ */
+static void index_resize(Database *db, int newCapacity){
+	IndexSlot *oldIndex = db->index;
+	int oldCapacity = db->indexCapacity;
+
+	stat_count(STAT_INDEX_RESIZES, 1);
+	db->indexCapacity = newCapacity;
+	db->index = (IndexSlot *)malloc(db->indexCapacity * sizeof(IndexSlot));
+	if(db->index == NULL){
+		fprintf(stderr, "Failed to allocate memory for expanding index.\n");
+		exit(1);
+	}
+	for(int i = 0; i < db->indexCapacity; i++){
+		db->index[i].record = -1;
+	}
+
+	db->indexCount = 0;
+	for(int i = 0; i < oldCapacity; i++){
+		if(oldIndex[i].record != -1){
+			index_place(db, oldIndex[i].hash, oldIndex[i].record);
+		}
+	}
+	if(!db_in_mapping(db, oldIndex)){
+		free(oldIndex);
+	}
+}
+
+/*
+ * Doubles the number of slots in the index
+ */
+static void index_grow(Database *db){
+	index_resize(db, db->indexCapacity*2);
+}
+
+/*
+ * Adds record number 'record' to the hash index
+ * if its handle is already indexed the earlier record is kept, so lookups keep returning the first match
+ */
+static void index_insert_hashed(Database *db, int record, unsigned int hash){
+	char const *handle = db->records[record].handle;
+	unsigned int mask = db->indexCapacity - 1;
+
+	for(unsigned int slot = hash & mask; db->index[slot].record != -1; slot = (slot + 1) & mask){
+		if(db->index[slot].hash == hash && strcmp(db->records[db->index[slot].record].handle, handle) == 0){
+			return; //duplicate handle, first occurrence wins
+		}
+	}
+
+	//keep the load factor at or below one half
+	if((db->indexCount + 1)*2 > db->indexCapacity){
+		index_grow(db);
+	}
+	index_place(db, hash, record);
+}
+
+static void index_insert(Database *db, int record){
+	index_insert_hashed(db, record, db_hash(db->records[record].handle));
+}
+/*
+ * adds a freshly appended record to the secondary indexes that have been built
+ */
+static void index_added(Database *db, int record){
+	stat_count(STAT_APPENDS, 1);
+	if(db->byFollowers != NULL){
+		sorted_insert(db->byFollowers, db->records[record].followerCount, record);
+	}
+	if(db->byDate != NULL){
+		sorted_insert(db->byDate, db->records[record].dateLastModified, record);
+	}
+	if(db->followerColumn != NULL){
+		db->followerColumn[record] = db->records[record].followerCount;
+		db->dateColumn[record] = db->records[record].dateLastModified;
+	}
+	if(db->byHandle != NULL){
+		prefix_add(db->byHandle, db->records, record);
+	}
+	if(db->trigrams != NULL){
+		trigram_add(db->trigrams, db->records, record);
+	}
+	if(db->words != NULL){
+		word_add(db->words, db->records, record);
+	}
+}
+
+/*
+ * resizes one numeric column to 'capacity' entries
+ */
+static unsigned long *resize_column(unsigned long *column, int capacity){
+	column = realloc(column, capacity * sizeof(unsigned long));
+	if(column == NULL){
+		fprintf(stderr, "Failed to allocate memory for columns.\n");
+		exit(1);
+	}
+	return column;
+}
+
+/*
+ * resizes the deleted bitmap to cover 'capacity' records, clearing any new bits
+ */
+static void resize_dead(Database *db, int capacity){
+	size_t oldWords = db->dead == NULL ? 0 : ((size_t)db->capacity + 63) / 64;
+	size_t words = ((size_t)capacity + 63) / 64;
+
+	db->dead = realloc(db->dead, (words + 1) * sizeof(unsigned long));
+	if(db->dead == NULL){
+		fprintf(stderr, "Failed to allocate memory for deleted records.\n");
+		exit(1);
+	}
+	if(words > oldWords){
+		memset(db->dead + oldWords, 0, (words - oldWords) * sizeof(unsigned long));
+	}
+}
+
+/*
+ * moves the records array to one with room for 'newCapacity' records
+ * realloc can extend the block in place, and glibc serves large blocks with mmap so it grows them with mremap
+ * instead of copying; only records still inside a snapshot mapping have to be copied out
+ */
+static void resize_records(Database *db, int newCapacity){
+	Record *newRecords;
+
+	stat_count(STAT_RECORD_RESIZES, 1);
+	if(db_in_mapping(db, db->records)){ //records loaded from a snapshot stay in the mapping
+		newRecords = (Record *)malloc(newCapacity * sizeof(Record));
+		if(newRecords != NULL){
+			memcpy(newRecords, db->records, db->size * sizeof(Record));
+		}
+	}else{
+		newRecords = (Record *)realloc(db->records, newCapacity * sizeof(Record));
+	}
+
 	if (newRecords == NULL){
 		fprintf(stderr, "Failed to allocate memory for expanding records.\n");                 
                 exit(1);
 	}
 
-	for (int i = 0; i < db->size; i++){
-		newRecords[i] = db->records[i];
+	db->records = newRecords;
+	if(db->dead != NULL){
+		resize_dead(db, newCapacity);
 	}
+	db->capacity = newCapacity; 
 
-	free(db->records);
+	if(db->followerColumn != NULL){
+		db->followerColumn = resize_column(db->followerColumn, newCapacity);
+		db->dateColumn = resize_column(db->dateColumn, newCapacity);
+	}
+}
 
-	db->records = newRecords;
-	db->capacity = newCapacity; 
+/*
+ * doubles the capacity of the records array
+ */
+static void grow_records(Database *db){
+	resize_records(db, db->capacity*2);
+}
+
+/*
+ * makes room for 'count' more records so that appending them does not resize the records array or the index
+ * @param *db pointer to database
+ * @param int count number of records about to be appended
+ */
+void db_reserve(Database *db, int count){
+	if(count <= 0){
+		return;
 	}
-  db->records[db->size++] = *item;	
+	if(db->capacity - db->size < count){
+		int newCapacity = db->capacity*2;
+		if(newCapacity < db->size + count){
+			newCapacity = db->size + count;
+		}
+		resize_records(db, newCapacity);
+	}
+
+	int newSlots = db->indexCapacity;
+	while((db->indexCount + count)*2 > newSlots){
+		newSlots *= 2;
+	}
+	if(newSlots != db->indexCapacity){
+		index_resize(db, newSlots);
+	}
+}
+/*
+ * @param *comment null terminated comment, NULL is treated as an empty one
+ * @return the shared copy of the comment, cut to COMMENT_SIZE - 1 characters, owned by the database
+ */
+char const *db_intern_comment(Database *db, char const *comment){
+	if(comment == NULL){
+		comment = "";
+	}
+	return arena_intern(&db->strings, comment, strnlen(comment, COMMENT_SIZE - 1));
+}
+
+/*
+ * Copies the record pointed to by iten to the end of the database
+ * @param *db pointer to database
+ * @param *item pointer to item that will be appended to database
+ *
+ */
+void db_append(Database *db, const Record *item){
+	if(db->size == db->capacity){
+		grow_records(db);
+	}
+  db->records[db->size] = *item;
+  db->records[db->size].comment = db_intern_comment(db, item->comment);
+  index_insert(db, db->size);
+  index_added(db, db->size);
+  db->size++;
 }
 /* Returns a pointer to the item in the database at the given index
  * @param *db pointer to database
@@ -60,7 +324,7 @@ void db_append(Database *db, const Record *item){
 
 Record * db_index(Database *db, int index){
 	//if index is invalid (too big or negative then return NULL pointer)
-	if(index < 0 || index >= db->size){
+	if(index < 0 || index >= db->size || db_is_dead(db, index)){
 		return NULL;
 	}
 
@@ -74,14 +338,553 @@ Record * db_index(Database *db, int index){
  * @return a pointer to the first item in the database whose handle field equals the given value
  */
 Record *db_lookup(Database * db, char const *handle){
-	for(int i = 0; i < db->size; i++){
-		if(strcmp(db->records[i].handle, handle) == 0){
-			return &(db->records[i]);
+	unsigned int hash = db_hash(handle);
+	unsigned int mask = db->indexCapacity - 1;
+	unsigned long probes = 1;
+
+	stat_count(STAT_LOOKUPS, 1);
+	//walk the probe sequence until an empty slot is reached
+	for(unsigned int slot = hash & mask; db->index[slot].record != -1; slot = (slot + 1) & mask, probes++){
+		if(db->index[slot].hash == hash){
+			Record *record = &(db->records[db->index[slot].record]);
+			if(strcmp(record->handle, handle) == 0){
+				stat_record(STAT_LOOKUP_PROBES, probes);
+				return record;
+			}
 		}
 	}
+	stat_record(STAT_LOOKUP_PROBES, probes);
+	stat_count(STAT_LOOKUP_MISSES, 1);
 	return NULL; //no matching handle found
 }
 
+/*
+ * @return the index slot that points at record number 'record', or -1 if the record is not indexed
+ */
+static int index_slot_of(Database *db, int record){
+	unsigned int hash = db_hash(db->records[record].handle);
+	unsigned int mask = db->indexCapacity - 1;
+
+	for(unsigned int slot = hash & mask; db->index[slot].record != -1; slot = (slot + 1) & mask){
+		if(db->index[slot].record == record){
+			return slot;
+		}
+	}
+	return -1;
+}
+
+/*
+ * empties one index slot, shifting later entries of the probe run back so no tombstone is needed
+ */
+static void index_remove_slot(Database *db, unsigned int slot){
+	unsigned int mask = db->indexCapacity - 1;
+	unsigned int hole = slot;
+
+	for(unsigned int next = (hole + 1) & mask; db->index[next].record != -1; next = (next + 1) & mask){
+		unsigned int home = db->index[next].hash & mask;
+		//an entry can fill the hole only if the hole lies between its home slot and where it sits now
+		if(((next - home) & mask) >= ((next - hole) & mask)){
+			db->index[hole] = db->index[next];
+			hole = next;
+		}
+	}
+	db->index[hole].record = -1;
+	db->indexCount--;
+}
+
+/*
+ * starts compacting: the handle, trigram and word indexes name records by number and are rebuilt on next use,
+ * the hash and sorted indexes and the columns are kept in step as records move
+ */
+static void compact_begin(Database *db){
+	prefix_free(db->byHandle);
+	db->byHandle = NULL;
+	trigram_free(db->trigrams);
+	db->trigrams = NULL;
+	word_free(db->words);
+	db->words = NULL;
+
+	//records before the first deleted one stay where they are
+	int first = 0;
+	while(db->dead[first / 64] == 0){
+		first += 64;
+	}
+	while(!db_is_dead(db, first)){
+		first++;
+	}
+	db->compactFrom = first;
+	db->compactTo = first;
+}
+
+/*
+ * moves record 'from' down to the free slot 'to' and points every index at its new number
+ */
+static void compact_move(Database *db, int from, int to){
+	Record *record = &db->records[from];
+	int slot = index_slot_of(db, from);
+
+	if(slot != -1){ //records with a duplicate handle are not indexed
+		db->index[slot].record = to;
+	}
+	if(db->byFollowers != NULL){
+		sorted_remove(db->byFollowers, record->followerCount, from);
+		sorted_insert(db->byFollowers, record->followerCount, to);
+	}
+	if(db->byDate != NULL){
+		sorted_remove(db->byDate, record->dateLastModified, from);
+		sorted_insert(db->byDate, record->dateLastModified, to);
+	}
+	if(db->followerColumn != NULL){
+		db->followerColumn[to] = db->followerColumn[from];
+		db->dateColumn[to] = db->dateColumn[from];
+	}
+	db->records[to] = *record;
+	db->dead[to / 64] &= ~(1UL << (to % 64));
+	db->dead[from / 64] |= 1UL << (from % 64);
+}
+
+/*
+ * moves the comments of every record into a fresh arena and frees the old one with the comments no record uses
+ * costs one intern per record, paid for by the at least as many strings updates and compaction left behind
+ * pointers to comments taken before the call are invalid after it
+ */
+static void reclaim_strings(Database *db){
+	if(db->strings.tableCount <= 2 * (size_t)db->size + DB_RECLAIM_SLACK){
+		return;
+	}
+	StringArena fresh;
+	arena_init(&fresh);
+	for(int i = 0; i < db->size; i++){ //deleted records too, the word index still reads them
+		db->records[i].comment = arena_intern(&fresh, db->records[i].comment, strlen(db->records[i].comment));
+	}
+	arena_free(&db->strings);
+	db->strings = fresh;
+}
+
+/*
+ * ends a compaction once every live record has moved down: the deleted tail is cut off and the records array shrinks
+ */
+static void compact_end(Database *db){
+	int size = db->compactTo;
+
+	//every slot from size up is deleted now
+	if(size % 64 != 0){
+		db->dead[size / 64] &= (1UL << (size % 64)) - 1;
+	}
+	int firstWord = (size + 63) / 64;
+	int lastWord = (db->size + 63) / 64;
+	if(lastWord > firstWord){
+		memset(db->dead + firstWord, 0, (lastWord - firstWord) * sizeof(unsigned long));
+	}
+	db->deadCount -= db->size - size; //records deleted behind the compaction stay marked
+	db->size = size;
+	db->compactFrom = -1;
+
+	//records still in a snapshot mapping would have to be copied out to shrink, so they are left alone
+	if(db->capacity > 8 && db->size * 4 < db->capacity && !db_in_mapping(db, db->records)){
+		resize_records(db, db->size * 2 > 8 ? db->size * 2 : 8);
+	}
+	reclaim_strings(db);
+}
+
+/*
+ * does a bounded piece of the running compaction, if there is one
+ * compaction slides live records down over deleted ones, keeping their order, a few at a time so no command
+ * pays for the whole table; callers run a step after each change
+ * @return 1 if the compaction still has work left, 0 if none is running
+ */
+int db_compact_step(Database *db){
+	if(db->compactFrom < 0){
+		return 0;
+	}
+
+	int end = db->compactFrom + DB_COMPACT_STEP < db->size ? db->compactFrom + DB_COMPACT_STEP : db->size;
+	for(int from = db->compactFrom; from < end; from++){
+		if(!db_is_dead(db, from)){
+			if(from != db->compactTo){
+				compact_move(db, from, db->compactTo);
+			}
+			db->compactTo++;
+		}
+	}
+	db->compactFrom = end;
+	if(end == db->size){
+		compact_end(db);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * removes every deleted record now, for callers that need a table without holes such as the snapshot writer
+ */
+void db_compact(Database *db){
+	if(db->compactFrom < 0 && db->deadCount > 0){
+		compact_begin(db);
+	}
+	while(db_compact_step(db)){
+	}
+}
+
+/*
+ * deletes the record with 'handle'
+ * the record is unlinked from the hash and sorted indexes and marked deleted in O(1) expected time;
+ * its slot is reclaimed by compaction, which starts once enough of the table is deleted
+ * records after it may move, so pointers into records are not valid across a delete, and neither are comments:
+ * the end of a compaction can reclaim the string arena
+ * @return 1 if a record was deleted, 0 if there is no record with that handle
+ */
+int db_remove(Database *db, char const *handle){
+	unsigned int hash = db_hash(handle);
+	unsigned int mask = db->indexCapacity - 1;
+	unsigned int slot = hash & mask;
+
+	while(db->index[slot].record != -1
+	      && (db->index[slot].hash != hash || strcmp(db->records[db->index[slot].record].handle, handle) != 0)){
+		slot = (slot + 1) & mask;
+	}
+	if(db->index[slot].record == -1){
+		return 0;
+	}
+
+	int id = db->index[slot].record;
+	Record *record = &db->records[id];
+	index_remove_slot(db, slot);
+	if(db->byFollowers != NULL){
+		sorted_remove(db->byFollowers, record->followerCount, id);
+	}
+	if(db->byDate != NULL){
+		sorted_remove(db->byDate, record->dateLastModified, id);
+	}
+
+	if(db->dead == NULL){
+		resize_dead(db, db->capacity);
+	}
+	db->dead[id / 64] |= 1UL << (id % 64);
+	db->deadCount++;
+
+	//fewer handles than live records means a loaded file repeated one: the next live row with this handle takes over
+	if(db->indexCount < db->size - db->deadCount){
+		for(int i = id + 1; i < db->size; i++){
+			if(!db_is_dead(db, i) && strcmp(db->records[i].handle, handle) == 0){
+				index_insert_hashed(db, i, hash);
+				break;
+			}
+		}
+	}
+
+	if(db->compactFrom < 0 && db->deadCount * DB_COMPACT_RATIO > db->size){
+		compact_begin(db);
+	}
+	db_compact_step(db);
+	return 1;
+}
+
+/*
+ * @return the number of records that are not deleted
+ */
+int db_live_records(Database const *db){
+	return db->size - db->deadCount;
+}
+
+/*
+ * overwrites the mutable fields of a record, keeping the secondary indexes in step
+ * the comment it replaces is freed with the next reclaim of the string arena, which this call may start
+ * @param *record pointer returned by db_lookup or db_index
+ * @param *comment new comment, cut to COMMENT_SIZE - 1 characters
+ */
+void db_update_record(Database *db, Record *record, unsigned long followerCount, char const *comment, unsigned long dateLastModified){
+	int id = record - db->records;
+
+	if(db->byFollowers != NULL && record->followerCount != followerCount){
+		sorted_remove(db->byFollowers, record->followerCount, id);
+		sorted_insert(db->byFollowers, followerCount, id);
+	}
+
+	if(db->byDate != NULL && record->dateLastModified != dateLastModified){
+		sorted_remove(db->byDate, record->dateLastModified, id);
+		sorted_insert(db->byDate, dateLastModified, id);
+	}
+
+	if(comment != record->comment){
+		char const *old = record->comment;
+		record->comment = db_intern_comment(db, comment);
+		if(db->words != NULL && record->comment != old){
+			word_update(db->words, db->records, id);
+		}
+		reclaim_strings(db);
+	}
+	record->followerCount = followerCount;
+	record->dateLastModified = dateLastModified;
+
+	if(db->followerColumn != NULL){
+		db->followerColumn[id] = followerCount;
+		db->dateColumn[id] = dateLastModified;
+	}
+}
+
+/*
+ * turns on columnar mode: followerCount and dateLastModified are also kept in
+ * separate contiguous arrays, so scans over them do not pull handles and comments through the cache
+ * records stay where they are, so db_index and db_lookup keep returning Record pointers
+ */
+void db_enable_columns(Database *db){
+	if(db->followerColumn != NULL){
+		return;
+	}
+	db->followerColumn = resize_column(NULL, db->capacity);
+	db->dateColumn = resize_column(NULL, db->capacity);
+	for(int i = 0; i < db->size; i++){
+		db->followerColumn[i] = db->records[i].followerCount;
+		db->dateColumn[i] = db->records[i].dateLastModified;
+	}
+}
+
+//four lanes of unsigned long, lowered to whatever SIMD width the target has
+typedef unsigned long ulong4 __attribute__((vector_size(4 * sizeof(unsigned long))));
+
+/*
+ * counts the entries of 'column' in [lo, hi] with one branch-free compare per lane
+ */
+static long count_column(unsigned long const *column, int size, unsigned long lo, unsigned long hi){
+	unsigned long width = hi - lo;
+	ulong4 vlo = { lo, lo, lo, lo };
+	ulong4 vwidth = { width, width, width, width };
+	ulong4 counts = { 0, 0, 0, 0 };
+	int i = 0;
+
+	for(; i + 4 <= size; i += 4){
+		ulong4 v;
+		memcpy(&v, column + i, sizeof(v));
+		//v - lo <= hi - lo is true exactly when lo <= v <= hi; a true lane is all ones, so subtracting adds one
+		counts -= (ulong4)((v - vlo) <= vwidth);
+	}
+
+	long count = counts[0] + counts[1] + counts[2] + counts[3];
+	for(; i < size; i++){
+		count += column[i] - lo <= width;
+	}
+	return count;
+}
+
+/*
+ * @return the number of deleted records with between lo and hi followers, read from the same place the scan reads
+ * walks the deleted bitmap a word at a time, so a table without deletes costs nothing
+ */
+static long count_dead(Database *db, unsigned long lo, unsigned long hi){
+	long count = 0;
+
+	if(db->deadCount == 0){
+		return 0;
+	}
+	for(int word = 0; word * 64 < db->size; word++){
+		for(unsigned long bits = db->dead[word]; bits != 0; bits &= bits - 1){
+			int i = word * 64 + __builtin_ctzl(bits);
+			unsigned long followers = db->followerColumn != NULL ? db->followerColumn[i] : db->records[i].followerCount;
+			count += followers - lo <= hi - lo;
+		}
+	}
+	return count;
+}
+
+/*
+ * @return the number of records with between lo and hi followers inclusive
+ * scans the follower column in columnar mode and the records otherwise;
+ * deleted records are counted by the scan and taken off afterwards, so the loop itself stays branch free
+ */
+long db_count_followers(Database *db, unsigned long lo, unsigned long hi){
+	if(hi < lo){
+		return 0;
+	}
+	if(db->followerColumn != NULL){
+		return count_column(db->followerColumn, db->size, lo, hi) - count_dead(db, lo, hi);
+	}
+
+	long count = 0;
+	for(int i = 0; i < db->size; i++){
+		count += db->records[i].followerCount - lo <= hi - lo;
+	}
+	return count - count_dead(db, lo, hi);
+}
+
+/*
+ * key and record number pair, used to bulk build sorted indexes
+ */
+typedef struct KeyId {
+	unsigned long key;
+	int id;
+} KeyId;
+
+static int compare_key_id(void const *a, void const *b){
+	KeyId const *x = a;
+	KeyId const *y = b;
+	if(x->key != y->key){
+		return x->key < y->key ? -1 : 1;
+	}
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+/*
+ * builds a sorted index over one numeric field of every record
+ * @param size_t offset offsetof the field in Record
+ */
+static SortedIndex *build_sorted_index(Database *db, size_t offset){
+	KeyId *pairs = malloc((db->size + 1) * sizeof(KeyId));
+	unsigned long *keys = malloc((db->size + 1) * sizeof(unsigned long));
+	int *ids = malloc((db->size + 1) * sizeof(int));
+	if(pairs == NULL || keys == NULL || ids == NULL){
+		fprintf(stderr, "Failed to allocate memory for index.\n");
+		exit(1);
+	}
+
+	int count = 0;
+	for(int i = 0; i < db->size; i++){
+		if(db_is_dead(db, i)){
+			continue;
+		}
+		pairs[count].key = *(unsigned long const *)((char const *)&db->records[i] + offset);
+		pairs[count].id = i;
+		count++;
+	}
+	qsort(pairs, count, sizeof(KeyId), compare_key_id);
+	for(int i = 0; i < count; i++){
+		keys[i] = pairs[i].key;
+		ids[i] = pairs[i].id;
+	}
+
+	SortedIndex *index = sorted_create();
+	sorted_build(index, keys, ids, count);
+	free(pairs);
+	free(keys);
+	free(ids);
+	return index;
+}
+
+/*
+ * @return the index of records by followerCount, building it on first use
+ * once built it is kept up to date by db_append and db_update_record
+ */
+SortedIndex *db_followers_index(Database *db){
+	if(db->byFollowers == NULL){
+		db->byFollowers = build_sorted_index(db, offsetof(Record, followerCount));
+	}
+	return db->byFollowers;
+}
+
+/*
+ * @return the index of records by dateLastModified, building it on first use
+ * once built it is kept up to date by db_append and db_update_record
+ */
+SortedIndex *db_dates_index(Database *db){
+	if(db->byDate == NULL){
+		db->byDate = build_sorted_index(db, offsetof(Record, dateLastModified));
+	}
+	return db->byDate;
+}
+
+/*
+ * frees the sorted, handle, trigram and word indexes; each is rebuilt on its next use
+ * for bulk changes that would otherwise update them one record at a time
+ */
+void db_drop_indexes(Database *db){
+	sorted_free(db->byFollowers);
+	db->byFollowers = NULL;
+	sorted_free(db->byDate);
+	db->byDate = NULL;
+	prefix_free(db->byHandle);
+	db->byHandle = NULL;
+	trigram_free(db->trigrams);
+	db->trigrams = NULL;
+	word_free(db->words);
+	db->words = NULL;
+}
+
+/*
+ * drops deleted records from a list of record numbers returned by one of the handle or word indexes,
+ * which keep deleted records until the next compaction
+ * @return the number of records left
+ */
+static int drop_dead(Database *db, int *ids, int count){
+	int kept = 0;
+
+	if(db->deadCount == 0){
+		return count;
+	}
+	for(int i = 0; i < count; i++){
+		if(!db_is_dead(db, ids[i])){
+			ids[kept++] = ids[i];
+		}
+	}
+	return kept;
+}
+
+/*
+ * @return the index of records by handle, building it on first use
+ * once built it is kept up to date by db_append; handles never change after that
+ * a compaction renumbers records, so one that is running is finished first and the index is dropped when the next starts
+ */
+PrefixIndex *db_prefix_index(Database *db){
+	if(db->byHandle == NULL){
+		while(db_compact_step(db)){
+		}
+		db->byHandle = prefix_build(db->records, db->size);
+	}
+	return db->byHandle;
+}
+
+/*
+ * @return the trigram index of handles, building it on first use
+ * once built it is kept up to date by db_append, and dropped by compaction like the handle index
+ */
+TrigramIndex *db_trigram_index(Database *db){
+	if(db->trigrams == NULL){
+		while(db_compact_step(db)){
+		}
+		db->trigrams = trigram_build(db->records, db->size);
+	}
+	return db->trigrams;
+}
+
+/*
+ * @param **ids set to a malloc'd array of the records whose handle starts with 'prefix', ordered by handle
+ * @return the number of matches
+ */
+int db_find_prefix(Database *db, char const *prefix, int **ids){
+	int count = prefix_find(db_prefix_index(db), db->records, prefix, ids);
+	return drop_dead(db, *ids, count);
+}
+
+/*
+ * @param **ids set to a malloc'd array of the records whose handle contains 'substring', in record order
+ * @return the number of matches
+ */
+int db_grep_handles(Database *db, char const *substring, int **ids){
+	int count = trigram_grep(db_trigram_index(db), db->records, db->size, substring, ids);
+	return drop_dead(db, *ids, count);
+}
+
+/*
+ * @return the word index of comments, building it on first use
+ * once built it is kept up to date by db_append and db_update_record, and dropped by compaction like the handle index
+ */
+WordIndex *db_word_index(Database *db){
+	if(db->words == NULL){
+		while(db_compact_step(db)){
+		}
+		db->words = word_build(db->records, db->size);
+	}
+	return db->words;
+}
+
+/*
+ * @param **ids set to a malloc'd array of the records whose comment holds every word of 'query', in record order
+ * @return the number of matches, -1 if the query holds no words
+ */
+int db_search_comments(Database *db, char const *query, int **ids){
+	int count = word_search(db_word_index(db), db->records, query, ids);
+	return count < 0 ? count : drop_dead(db, *ids, count);
+}
+
 /* Releases the memory held by the underlying array
  * @param *db takes in a pointer to a database as an argument
  *
@@ -90,14 +893,60 @@ void db_free(Database *db){
 	if(db == NULL) return; //database is null return
 	
 	if(db->records != NULL){			
-		free(db->records); //free allocated memory
+		if(!db_in_mapping(db, db->records)){
+			free(db->records); //free allocated memory
+		}
 		db->records = NULL; //make sure no dangling pointers
 	}
 
+	if(db->index != NULL){
+		if(!db_in_mapping(db, db->index)){
+			free(db->index);
+		}
+		db->index = NULL;
+	}
+
+	sorted_free(db->byFollowers);
+	db->byFollowers = NULL;
+	sorted_free(db->byDate);
+	db->byDate = NULL;
+	free(db->followerColumn);
+	free(db->dateColumn);
+	db->followerColumn = NULL;
+	db->dateColumn = NULL;
+	prefix_free(db->byHandle);
+	db->byHandle = NULL;
+	trigram_free(db->trigrams);
+	db->trigrams = NULL;
+	word_free(db->words);
+	db->words = NULL;
+	free(db->dead);
+	db->dead = NULL;
+	db->deadCount = 0;
+	db->compactFrom = -1;
+	arena_free(&db->strings);
+
+	if(db->mapping != NULL){
+		munmap(db->mapping, db->mappingLength);
+		db->mapping = NULL;
+		db->mappingLength = 0;
+	}
+	db->indexCapacity = 0;
+	db->indexCount = 0;
+
 	db->capacity = 0;
 	db->size =0;
 	
 }
+/*
+ * @param *ptr pointer to check
+ * @return 1 if ptr points into the snapshot file the database was loaded from, 0 otherwise
+ */
+int db_in_mapping(Database const *db, void const *ptr){
+	char const *start = db->mapping;
+	char const *p = ptr;
+	return start != NULL && p >= start && p < start + db->mappingLength;
+}
 /*
  * @param **token takes in a pointer to a string literal of the handle name
  * @param *record takes in a pointer to a record which the string literal will be written into the handle member of that record
@@ -119,18 +968,18 @@ void parse_handle(char **token, Record *record){
 
 /*
  * @param **token takes in a pointer to a string literal of the comment name
- * @param *record takes in a pointer to a record which the string literal will be written into the comment member of that record
+ * @param *comment takes in a buffer of COMMENT_SIZE characters which the string literal will be written into
  */
 
-void parse_comment(char **token, Record *record){
+void parse_comment(char **token, char *comment){
 	if(*token != NULL){
-		if(strlen(*token) < sizeof(record->comment)){
-                     strcpy(record->comment, *token);
+		if(strlen(*token) < COMMENT_SIZE){
+                     strcpy(comment, *token);
 		}else{
 			fprintf(stderr, "Your comment is too long it will be truncated.\n");
-			int lastIndex = sizeof(record->comment)-1;
-			strncpy(record->comment, *token, lastIndex);
-			record->comment[lastIndex] = '\0';
+			int lastIndex = COMMENT_SIZE-1;
+			strncpy(comment, *token, lastIndex);
+			comment[lastIndex] = '\0';
 		}
 
 	}
@@ -170,10 +1019,13 @@ void parse_dateLastModified(char **token, Record *record){
 }
 /*
  * @param char const *line string literal to be parsed into a type Record
+ * @param char *comment buffer of COMMENT_SIZE characters that the comment of the record will point to
  * parses a single line of CSV data into one Record 
  */
-Record parse_record(char const * line){
+Record parse_record(char const * line, char * comment){
 	Record record = {0}; //initialize all members of record to 0
+	comment[0] = '\0';
+	record.comment = comment;
 
 	char *lineCopy = malloc(strlen(line) + 1); //allocates memory to copy line of csv file into
 	if(lineCopy == NULL){
@@ -196,7 +1048,7 @@ Record parse_record(char const * line){
 		token = strtok(NULL, ","); 
 		parse_followerCount(&token, &record); //until the second , is the followerCount
 		token = strtok(NULL, ",");
-		parse_comment(&token, &record); //until the third , is the comment
+		parse_comment(&token, comment); //until the third , is the comment
 		token = strtok(NULL, ",");
 		parse_dateLastModified(&token, &record); //until the end of the line is the dateLastModified
         }
@@ -204,26 +1056,479 @@ Record parse_record(char const * line){
 	free(lineCopy); //avoid memory leak
 	return record; //return the new record
 }
+
+/*
+ * converts the token [start, end) the same way strtoul(token, &endPtr, 10) would
+ * @param *value receives the converted number
+ * @return 0 if no digits were found, 1 otherwise
+ */
+static int parse_number(char const *start, char const *end, unsigned long *value){
+	char const *p = start;
+	int negative = 0;
+	int overflow = 0;
+	unsigned long result = 0;
+
+	while(p < end && (*p == ' ' || (*p >= '\t' && *p <= '\r'))){ //isspace in the C locale
+		p++;
+	}
+	if(p < end && (*p == '+' || *p == '-')){
+		negative = *p == '-';
+		p++;
+	}
+
+	char const *digits = p;
+	while(p < end && *p >= '0' && *p <= '9'){
+		unsigned long digit = *p - '0';
+		if(result > (ULONG_MAX - digit) / 10){
+			overflow = 1;
+		}
+		result = result*10 + digit;
+		p++;
+	}
+	if(p == digits){
+		return 0;
+	}
+
+	if(overflow){
+		*value = ULONG_MAX; //strtoul clamps regardless of the sign
+	}else{
+		*value = negative ? -result : result;
+	}
+	return 1;
+}
+
+/*
+ * copies the token [start, end) into a fixed size field, truncating it the way parse_handle does
+ * @return 1 if the token had to be truncated
+ */
+static int copy_field(char *field, size_t size, char const *start, char const *end){
+	size_t len = end - start;
+	int truncated = 0;
+
+	if(len >= size){
+		len = size - 1;
+		truncated = 1;
+	}
+	memcpy(field, start, len);
+	field[len] = '\0';
+	return truncated;
+}
+
+/*
+ * finds the next token of [*cursor, end) using the same rules as strtok with a "," delimiter
+ * @return 1 and sets [*tokenStart, *tokenEnd) if there is a token, 0 otherwise
+ */
+static int next_token(char const **cursor, char const *end, char const **tokenStart, char const **tokenEnd){
+	char const *p = *cursor;
+
+	while(p < end && *p == ','){ //strtok skips empty tokens
+		p++;
+	}
+	if(p == end){
+		*cursor = end;
+		return 0;
+	}
+
+	char const *comma = memchr(p, ',', end - p);
+	*tokenStart = p;
+	*tokenEnd = comma != NULL ? comma : end;
+	*cursor = comma != NULL ? comma + 1 : end;
+	return 1;
+}
+
+/*
+ * parses one line of CSV data in place, without copying it first
+ * @param *line first character of the line
+ * @param *end one past the last character of the line, excluding the newline
+ * @param *record zeroed and then filled in with the fields of the line, except for the comment
+ * @param **comment, *commentLength receive the comment as a slice of the line, already cut to COMMENT_SIZE - 1 characters
+ * @return bitmask of PARSE_* warnings, in the same situations parse_record prints them
+ */
+int parse_line(char const *line, char const *end, Record *record, char const **comment, size_t *commentLength){
+	char const *cursor = line;
+	char const *tokenStart;
+	char const *tokenEnd;
+	int warnings = 0;
+
+	memset(record, 0, sizeof(*record));
+	*comment = line;
+	*commentLength = 0;
+
+	//parse_record works on a C string, so anything after an embedded null terminator is ignored
+	char const *nul = memchr(line, '\0', end - line);
+	if(nul != NULL){
+		end = nul;
+	}
+
+	if(!next_token(&cursor, end, &tokenStart, &tokenEnd)){
+		return 0;
+	}
+	if(copy_field(record->handle, sizeof(record->handle), tokenStart, tokenEnd)){
+		warnings |= PARSE_HANDLE_TRUNCATED;
+	}
+
+	if(next_token(&cursor, end, &tokenStart, &tokenEnd)){
+		if(!parse_number(tokenStart, tokenEnd, &record->followerCount)){
+			warnings |= PARSE_FOLLOWERS_NO_DIGITS;
+		}
+	}
+
+	if(next_token(&cursor, end, &tokenStart, &tokenEnd)){
+		*comment = tokenStart;
+		*commentLength = tokenEnd - tokenStart;
+		if(*commentLength >= COMMENT_SIZE){
+			*commentLength = COMMENT_SIZE - 1;
+			warnings |= PARSE_COMMENT_TRUNCATED;
+		}
+	}
+
+	if(next_token(&cursor, end, &tokenStart, &tokenEnd)){
+		if(!parse_number(tokenStart, tokenEnd, &record->dateLastModified)){
+			warnings |= PARSE_DATE_NO_DIGITS;
+		}
+	}
+
+	return warnings;
+}
+
+/*
+ * prints the messages parse_record would have printed for the given warnings, in field order
+ * @param int warnings bitmask returned by parse_line
+ */
+void report_parse_warnings(int warnings){
+	if(warnings == 0){
+		return;
+	}
+	if(warnings & PARSE_HANDLE_TRUNCATED){
+		fprintf(stderr, "Your handle is too long it will be truncated.\n");
+	}
+	if(warnings & PARSE_FOLLOWERS_NO_DIGITS){
+		fprintf(stderr, "Error: No digits were found in followerCount.\n");
+	}
+	if(warnings & PARSE_COMMENT_TRUNCATED){
+		fprintf(stderr, "Your comment is too long it will be truncated.\n");
+	}
+	if(warnings & PARSE_DATE_NO_DIGITS){
+		fprintf(stderr, "Error: No digits were found in dateLastModified.\n");
+	}
+}
+
+/*
+ * parses [line, end) straight into the next free slot of the records array
+ */
+static void load_line(Database *db, char const *line, char const *end){
+	if(db->size == db->capacity){
+		grow_records(db);
+	}
+	Record *record = &db->records[db->size];
+	char const *comment;
+	size_t commentLength;
+
+	report_parse_warnings(parse_line(line, end, record, &comment, &commentLength));
+	record->comment = arena_intern(&db->strings, comment, commentLength);
+	index_insert(db, db->size);
+	index_added(db, db->size);
+	db->size++;
+}
+
+/*
+ * reserves room for the records in [data, data + length), estimating the line count from the
+ * average line length of LOAD_SAMPLES stretches spread over the buffer, since lines tend to get longer towards the end
+ */
+static void reserve_for_buffer(Database *db, char const *data, size_t length){
+	size_t sampled = 0;
+	size_t lines = 0;
+
+	if(length == 0){
+		return;
+	}
+	for(int i = 0; i < LOAD_SAMPLES; i++){
+		char const *start = data + length / LOAD_SAMPLES * i;
+		size_t sample = data + length - start < LOAD_SAMPLE_BYTES ? data + length - start : LOAD_SAMPLE_BYTES;
+		for(char const *p = start; (p = memchr(p, '\n', start + sample - p)) != NULL; p++){
+			lines++;
+		}
+		sampled += sample;
+	}
+
+	double estimate = (double)length / sampled * (lines + 1);
+	estimate += estimate / 16; //a little slack so a slight underestimate does not double everything at the end
+	if(estimate > INT_MAX / 2){
+		estimate = INT_MAX / 2;
+	}
+	db_reserve(db, (int)estimate);
+}
+
+/*
+ * appends every line of the buffer [data, data + length) to the database
+ * the last line does not need to end in a newline
+ */
+void db_load_buffer(Database *db, char const *data, size_t length){
+	char const *end = data + length;
+	char const *line = data;
+
+	stat_count(STAT_BYTES_PARSED, length);
+	reserve_for_buffer(db, data, length);
+	while(line < end){
+		char const *newline = memchr(line, '\n', end - line);
+		if(newline == NULL){
+			load_line(db, line, end);
+			break;
+		}
+		load_line(db, line, newline);
+		line = newline + 1;
+	}
+}
+
+/*
+ * records parsed by one worker of the parallel loader, in file order
+ */
+typedef struct LoadChunk {
+	char const *start; //first byte of the chunk, always the start of a line
+	char const *end; //one past the last byte of the chunk
+	Record *records;
+	unsigned int *hashes; //db_hash of each handle, computed off the main thread
+	unsigned char *warnings; //parse_line result for each record
+	char const **comments; //comment of each record as a slice of the buffer, interned while stitching
+	unsigned char *commentLengths;
+	int size;
+	int capacity;
+	pthread_t thread;
+	int threaded; //1 if the chunk is being parsed on 'thread'
+} LoadChunk;
+
+/*
+ * worker thread: parses every line of one chunk into the chunk's own buffers
+ */
+static void *load_chunk(void *arg){
+	LoadChunk *chunk = arg;
+	char const *line = chunk->start;
+
+	while(line < chunk->end){
+		if(chunk->size == chunk->capacity){
+			chunk->capacity = chunk->capacity*2;
+			chunk->records = realloc(chunk->records, chunk->capacity * sizeof(Record));
+			chunk->hashes = realloc(chunk->hashes, chunk->capacity * sizeof(unsigned int));
+			chunk->warnings = realloc(chunk->warnings, chunk->capacity);
+			chunk->comments = realloc(chunk->comments, chunk->capacity * sizeof(char const *));
+			chunk->commentLengths = realloc(chunk->commentLengths, chunk->capacity);
+			if(chunk->records == NULL || chunk->hashes == NULL || chunk->warnings == NULL
+			   || chunk->comments == NULL || chunk->commentLengths == NULL){
+				fprintf(stderr, "Failed to allocate memory for loading records.\n");
+				exit(1);
+			}
+		}
+
+		char const *newline = memchr(line, '\n', chunk->end - line);
+		char const *lineEnd = newline != NULL ? newline : chunk->end;
+		Record *record = &chunk->records[chunk->size];
+
+		size_t commentLength;
+
+		chunk->warnings[chunk->size] = parse_line(line, lineEnd, record, &chunk->comments[chunk->size], &commentLength);
+		chunk->commentLengths[chunk->size] = commentLength;
+		chunk->hashes[chunk->size] = db_hash(record->handle);
+		chunk->size++;
+		line = lineEnd + 1;
+	}
+	return NULL;
+}
+
+/*
+ * splits the buffer into newline aligned chunks, parses them on 'threads' worker threads
+ * and appends the results in file order, so the database ends up exactly as a serial load would leave it
+ */
+void db_load_buffer_parallel(Database *db, char const *data, size_t length, int threads){
+	//below this size starting threads costs more than it saves
+	if(threads <= 1 || length < (1 << 20)){
+		db_load_buffer(db, data, length);
+		return;
+	}
+
+	stat_count(STAT_BYTES_PARSED, length);
+	LoadChunk *chunks = calloc(threads, sizeof(LoadChunk));
+	if(chunks == NULL){
+		fprintf(stderr, "Failed to allocate memory for loader threads.\n");
+		exit(1);
+	}
+
+	char const *end = data + length;
+	char const *start = data;
+	for(int i = 0; i < threads; i++){
+		char const *chunkEnd = end;
+		if(i < threads - 1){
+			chunkEnd = data + length / threads * (i + 1);
+			if(chunkEnd < start){
+				chunkEnd = start;
+			}
+			//move the boundary just past the next newline so no line is split
+			char const *newline = memchr(chunkEnd, '\n', end - chunkEnd);
+			chunkEnd = newline != NULL ? newline + 1 : end;
+		}
+
+		chunks[i].start = start;
+		chunks[i].end = chunkEnd;
+		chunks[i].capacity = (chunkEnd - start) / 32 + 16; //guess from a short line length
+		chunks[i].records = malloc(chunks[i].capacity * sizeof(Record));
+		chunks[i].hashes = malloc(chunks[i].capacity * sizeof(unsigned int));
+		chunks[i].warnings = malloc(chunks[i].capacity);
+		chunks[i].comments = malloc(chunks[i].capacity * sizeof(char const *));
+		chunks[i].commentLengths = malloc(chunks[i].capacity);
+		if(chunks[i].records == NULL || chunks[i].hashes == NULL || chunks[i].warnings == NULL
+		   || chunks[i].comments == NULL || chunks[i].commentLengths == NULL){
+			fprintf(stderr, "Failed to allocate memory for loading records.\n");
+			exit(1);
+		}
+		chunks[i].threaded = pthread_create(&chunks[i].thread, NULL, load_chunk, &chunks[i]) == 0;
+		if(!chunks[i].threaded){
+			load_chunk(&chunks[i]); //no thread available, parse it here instead
+		}
+		start = chunkEnd;
+	}
+
+	//stitch the chunks together in order; index_insert keeps the first occurrence of a duplicate
+	for(int i = 0; i < threads; i++){
+		LoadChunk *chunk = &chunks[i];
+		if(chunk->threaded){
+			pthread_join(chunk->thread, NULL);
+		}
+
+		db_reserve(db, chunk->size);
+		memcpy(&db->records[db->size], chunk->records, chunk->size * sizeof(Record));
+		for(int j = 0; j < chunk->size; j++){
+			report_parse_warnings(chunk->warnings[j]);
+			db->records[db->size].comment = arena_intern(&db->strings, chunk->comments[j], chunk->commentLengths[j]);
+			index_insert_hashed(db, db->size, chunk->hashes[j]);
+			index_added(db, db->size);
+			db->size++;
+		}
+
+		free(chunk->records);
+		free(chunk->hashes);
+		free(chunk->warnings);
+		free(chunk->comments);
+		free(chunk->commentLengths);
+	}
+
+	free(chunks);
+}
+
 /*
  * @param *db pointer to already initialized dtabase that the records will be read from
  * Appends the records read from the file at 'path' into the already intialized database 'db'
+ * the file is memory mapped and parsed in place; anything that cannot be mapped (pipes, empty files) is read line by line
+ * a file written by db_write_csv_compressed is recognized by its magic bytes and decompressed while it is parsed
  */
 
 void db_load_csv(Database *db, char const *path){
-    FILE *file = fopen(path, "rt"); 
-    
-    if(file == NULL){
+    db_load_csv_parallel(db, path, 1);
+}
+
+/*
+ * loads a file written by db_write_csv_compressed; a thread decompresses it block by block while this one parses,
+ * one buffer of complete lines at a time
+ */
+static void load_compressed(Database *db, int fd, char const *path){
+    CodecStream stream;
+    int text = codec_reader_open(&stream, fd);
+    if(text == -1){
+        fprintf(stderr, "Error: unable to decompress '%s'.\n", path);
+        return;
+    }
+
+    size_t capacity = CODEC_BLOCK;
+    size_t length = 0;
+    char *buffer = malloc(capacity);
+    if(buffer == NULL){
+        fprintf(stderr, "Failed to allocate memory for loading records.\n");
+        exit(1);
+    }
+    for(;;){
+        ssize_t got = read(text, buffer + length, capacity - length);
+        if(got == -1 && errno == EINTR){
+            continue;
+        }
+        if(got <= 0){
+            break;
+        }
+        length += got;
+        if(length < capacity){
+            continue;
+        }
+        char const *lastNewline = buffer + length - 1;
+        while(lastNewline >= buffer && *lastNewline != '\n'){
+            lastNewline--;
+        }
+        if(lastNewline < buffer){ //a line longer than the buffer
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+            if(buffer == NULL){
+                fprintf(stderr, "Failed to allocate memory for loading records.\n");
+                exit(1);
+            }
+            continue;
+        }
+        size_t complete = lastNewline + 1 - buffer;
+        db_load_buffer(db, buffer, complete);
+        memmove(buffer, buffer + complete, length - complete);
+        length -= complete;
+    }
+    if(length > 0){
+        db_load_buffer(db, buffer, length);
+    }
+    free(buffer);
+    if(!codec_reader_close(&stream)){
+        fprintf(stderr, "Error: '%s' is truncated or corrupt, only the records before the damage were loaded.\n", path);
+    }
+}
+
+/*
+ * maps or reads the file at 'path' and hands it to the loaders
+ * files that start with CODEC_MAGIC are decompressed on the way
+ */
+static void load_csv(Database *db, char const *path, int threads){
+    int fd = open(path, O_RDONLY);
+
+    if(fd == -1){
        fprintf(stderr, "No file %s exists, failed to read from %s, returning early\n", path, path);
        return; //Return early if the file cannot be opened
     }
+
+    if(codec_detect(fd)){
+        load_compressed(db, fd, path);
+        close(fd);
+        return;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED){
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            db_load_buffer_parallel(db, data, st.st_size, threads);
+            munmap(data, st.st_size);
+            close(fd);
+            return;
+        }
+    }
+
+    FILE *file = fdopen(fd, "rt");
+    if(file == NULL){
+        close(fd);
+        return;
+    }
     //copied from man pages
     char *line = NULL;
     size_t len =0;
     ssize_t nread;
 
     while(((nread = getline(&line, &len, file)) != -1)){
-	    Record record = parse_record(line);
-	    db_append(db, &record);
+	    char const *end = line + nread;
+	    if(nread > 0 && line[nread - 1] == '\n'){
+		    end--;
+	    }
+	    stat_count(STAT_BYTES_PARSED, nread);
+	    load_line(db, line, end);
     }
 
     free(line); //avoid memory leak
@@ -231,38 +1536,108 @@ void db_load_csv(Database *db, char const *path){
 }
 
 /*
- * @param *db pointer to already initialized database that the records will written into
- *  Overwrites the file located at 'path' with the contents of the database, represented in CSV format
+ * same as db_load_csv but parses large files on 'threads' threads
+ * the resulting database is identical to the one db_load_csv produces
  */
+void db_load_csv_parallel(Database *db, char const *path, int threads){
+    unsigned long start = stat_now();
+    load_csv(db, path, threads);
+    stat_record(STAT_LOAD_NS, stat_now() - start);
+}
 
+/*
+ * writes the CSV file for db_write_csv and db_write_csv_compressed
+ * @return 1 if every byte reached the disk, 0 otherwise
+ */
+static int write_csv(Database *db, const char *path, int compressed) {
+    unsigned long start = stat_now();
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
 
-void db_write_csv(Database *db, const char *path) {
-    FILE *file = fopen(path, "wt");
+    if (fd == -1) {
+        fprintf(stderr, "Error: unable to open or create file '%s'.\n", path);
+        return 0;
+    }
 
-    if (file == NULL) {
-        // If the initial attempt to open the specified file fails,
-        // try to create or open a fallback file named "database.csv".
-        printf("Unable to open or create file '%s'. Trying to create 'database.csv' instead.\n", path);
-        file = fopen("database.csv", "wt");
-        if (file == NULL) {
-            // If opening the fallback file also fails, report the error and exit.
-            fprintf(stderr, "Failed to create fallback file 'database.csv'.\n");
-            exit(1);
-        }
+    // With compression on the buffer is flushed into a pipe to the compression thread instead of the file.
+    CodecStream stream;
+    int text = compressed ? codec_writer_open(&stream, fd) : fd;
+    if (text == -1) {
+        fprintf(stderr, "Error: failed to write '%s'.\n", path);
+        close(fd);
+        return 0;
     }
 
-    // Loop over the database and write each record to the file in CSV format.
+    // Loop over the database and format each record into the buffer, which is written out in large chunks.
+    OutBuf out;
+    out_open(&out, text);
     for (int i = 0; i < db->size; i++) {
-        Record *record = &db->records[i];
-        fprintf(file, "%s,%lu,%s,%lu\n",
-                record->handle,
-                record->followerCount,
-                record->comment,
-                record->dateLastModified);
+        if (!db_is_dead(db, i)) {
+            out_csv_record(&out, &db->records[i]);
+        }
+    }
+    int written = out_close(&out);
+    if (compressed) {
+        written &= codec_writer_close(&stream);
     }
 
-    // Properly close the file to avoid resource leaks.
-    fclose(file);
+    // Make sure the data is on disk before the caller renames the file over the old one.
+    written &= fsync(fd) == 0;
+    written &= close(fd) == 0;
+    if (!written) {
+        fprintf(stderr, "Error: failed to write '%s'.\n", path);
+    }
+    stat_record(STAT_WRITE_NS, stat_now() - start);
+    return written;
 }
 
+/*
+ * @param *db pointer to already initialized database that the records will written into
+ *  Overwrites the file located at 'path' with the contents of the database, represented in CSV format
+ * @return 1 on success, 0 if the file could not be opened or written completely
+ */
+
 
+int db_write_csv(Database *db, const char *path) {
+    return write_csv(db, path, 0);
+}
+
+/*
+ * same as db_write_csv but the file is block compressed, see codec.h; db_load_csv reads it back
+ * a thread compresses each block while this one formats the next
+ * @return 1 on success, 0 otherwise
+ */
+int db_write_csv_compressed(Database *db, const char *path) {
+    return write_csv(db, path, 1);
+}
+
+/*
+ * writes the records modified at or after 'since' to 'path' in CSV format, oldest change first
+ * the cost depends on the number of changed records, not on the size of the table
+ * @return number of records written, -1 if the file could not be created or written completely
+ */
+int db_write_csv_since(Database *db, const char *path, unsigned long since) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int count = 0;
+
+    if (fd == -1) {
+        fprintf(stderr, "Error: unable to open or create file '%s'.\n", path);
+        return -1;
+    }
+
+    OutBuf out;
+    out_open(&out, fd);
+    for (SortedNode *node = sorted_seek(db_dates_index(db), since); node != NULL; node = sorted_next(node)) {
+        out_csv_record(&out, &db->records[node->id]);
+        count++;
+    }
+    int written = out_close(&out);
+
+    // Same durability as db_write_csv: the changes are on disk before the caller reports them written.
+    written &= fsync(fd) == 0;
+    written &= close(fd) == 0;
+    if (!written) {
+        fprintf(stderr, "Error: failed to write '%s'.\n", path);
+        return -1;
+    }
+    return count;
+}
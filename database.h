@@ -1,31 +1,129 @@
 #ifndef DB_H
 #define DB_H
 
+#include <stddef.h>
+#include "sortedindex.h"
+#include "strarena.h"
+
+//comments are cut to COMMENT_SIZE - 1 characters, like the fixed size field they used to live in
+#define COMMENT_SIZE 64
+
 typedef struct Record { 
 char handle[32];
-char comment[64];
+char const *comment; //interned in the database's string arena, shared by every record with the same text
 long unsigned int followerCount;
 long unsigned int dateLastModified;
 } Record;
 
+typedef struct IndexSlot {
+ unsigned int hash; //hash of the handle stored in this slot
+ int record; //index into records, -1 if the slot is empty
+} IndexSlot;
+
 typedef struct Database { 
  Record *records;
  int capacity; //length of underlying array
  int size; //number of elements inside array
+ IndexSlot *index; //open addressing hash index on handle
+ int indexCapacity; //number of slots, always a power of two
+ int indexCount; //number of occupied slots
+ void *mapping; //snapshot file that records and index may point into, NULL if none
+ size_t mappingLength;
+ SortedIndex *byFollowers; //records ordered by followerCount, NULL until first needed
+ SortedIndex *byDate; //records ordered by dateLastModified, NULL until first needed
+ unsigned long *followerColumn; //copy of every followerCount, NULL unless columnar mode is on
+ unsigned long *dateColumn; //copy of every dateLastModified, NULL unless columnar mode is on
+ StringArena strings; //owns every comment
+ struct PrefixIndex *byHandle; //records ordered by handle for prefix search, NULL until first needed
+ struct TrigramIndex *trigrams; //handle trigrams for substring search, NULL until first needed
+ struct WordIndex *words; //comment words for full text search, NULL until first needed
+ unsigned long *dead; //one bit per slot of records, set for deleted records, NULL until the first delete
+ int deadCount; //number of deleted records below size
+ int compactFrom; //next record the running compaction looks at, -1 if no compaction is running
+ int compactTo; //slot the next live record moves to
 } Database;
 
+/*
+ * @return 1 if record 'index' was deleted and is waiting to be compacted away
+ */
+static inline int db_is_dead(Database const *db, int index){
+	return db->dead != NULL && (db->dead[index / 64] >> (index % 64) & 1);
+}
+
 Database db_create();
 
 void db_append(Database * db, Record const * item);
 
+void db_reserve(Database * db, int count);
+
 Record *db_index(Database * db, int index);
 
 Record *db_lookup(Database * db, char const * handle);
 
+int db_remove(Database * db, char const * handle);
+
+int db_live_records(Database const * db);
+
+int db_compact_step(Database * db);
+
+void db_compact(Database * db);
+
+char const *db_intern_comment(Database * db, char const * comment);
+
+void db_update_record(Database * db, Record * record, unsigned long followerCount, char const * comment, unsigned long dateLastModified);
+
+SortedIndex *db_followers_index(Database * db);
+
+SortedIndex *db_dates_index(Database * db);
+
+void db_drop_indexes(Database * db);
+
+struct PrefixIndex *db_prefix_index(Database * db);
+
+struct TrigramIndex *db_trigram_index(Database * db);
+
+int db_find_prefix(Database * db, char const * prefix, int ** ids);
+
+int db_grep_handles(Database * db, char const * substring, int ** ids);
+
+struct WordIndex *db_word_index(Database * db);
+
+int db_search_comments(Database * db, char const * query, int ** ids);
+
+unsigned int db_hash(char const * handle);
+
 void db_free(Database * db);
 
+void db_enable_columns(Database * db);
+
+long db_count_followers(Database * db, unsigned long lo, unsigned long hi);
+
+int db_in_mapping(Database const * db, void const * ptr);
+
 void db_load_csv(Database * db, char const * path);
 
-void db_write_csv(Database * db, char const * path);
+void db_load_buffer(Database * db, char const * data, size_t length);
+
+void db_load_csv_parallel(Database * db, char const * path, int threads);
+
+void db_load_buffer_parallel(Database * db, char const * data, size_t length, int threads);
+
+//warnings reported by parse_line, one bit per field that needed attention
+#define PARSE_HANDLE_TRUNCATED 1
+#define PARSE_FOLLOWERS_NO_DIGITS 2
+#define PARSE_COMMENT_TRUNCATED 4
+#define PARSE_DATE_NO_DIGITS 8
+
+Record parse_record(char const * line, char * comment);
+
+int parse_line(char const * line, char const * end, Record * record, char const ** comment, size_t * commentLength);
+
+void report_parse_warnings(int warnings);
+
+int db_write_csv(Database * db, char const * path);
+
+int db_write_csv_compressed(Database * db, char const * path);
+
+int db_write_csv_since(Database * db, char const * path, unsigned long since);
 
 #endif
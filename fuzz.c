@@ -0,0 +1,604 @@
+#define _GNU_SOURCE //open_memstream
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include "database.h"
+#include "output.h"
+#include "codec.h"
+#include "journal.h"
+#include "aggregate.h"
+
+/*
+ * differential fuzz harness for the fast parse and format paths
+ * every input is treated as a CSV file and run through today's reference code and the optimized path, and the results
+ * are compared byte for byte:
+ *   parse_record against parse_line, fields and warning messages, one line at a time
+ *   a getline style loop over parse_record and db_append against db_load_buffer, and db_load_buffer_parallel for large inputs
+ *   fprintf against out_csv_record and out_list_record
+ *   codec_compress followed by codec_decompress against the input, and codec_decompress on the raw input
+ *   journal_append followed by journal_replay against the records appended
+ *   aggregate_histogram, on one thread and on several, against counting one record at a time
+ *   db_remove of every handle in turn against the rows list shows, which db_lookup must still find
+ * built with clang -fsanitize=fuzzer this file is a libFuzzer target; AFL++ takes it the same way
+ * built with -DFUZZ_DRIVER it gets a main: "igdb-difftest FILE..." replays inputs ("-" for stdin, which also suits AFL),
+ * with no arguments it runs DIFFTEST_ITERATIONS generated inputs, random and adversarial
+ * a mismatch prints both sides and aborts, so every fuzzer and sanitizer reports it as a crash
+ */
+
+//inputs of at least this size also go through the parallel loader, which falls back to the serial one below it
+#define FUZZ_PARALLEL_BYTES (1 << 20)
+#define DIFFTEST_ITERATIONS 20000
+
+/*
+ * reports a difference between the reference and the optimized path and stops
+ */
+static void mismatch(char const *what, char const *expected, size_t expectedLength, char const *got, size_t gotLength){
+	fprintf(stderr, "MISMATCH in %s\n  expected (%zu bytes): \"", what, expectedLength);
+	fwrite(expected, 1, expectedLength, stderr);
+	fprintf(stderr, "\"\n  got      (%zu bytes): \"", gotLength);
+	fwrite(got, 1, gotLength, stderr);
+	fprintf(stderr, "\"\n");
+	abort();
+}
+
+static void expect_bytes(char const *what, char const *expected, size_t expectedLength, char const *got, size_t gotLength){
+	if(expectedLength != gotLength || memcmp(expected, got, expectedLength) != 0){
+		mismatch(what, expected, expectedLength, got, gotLength);
+	}
+}
+
+static void expect_number(char const *what, unsigned long expected, unsigned long got){
+	char a[32], b[32];
+	if(expected != got){
+		snprintf(a, sizeof(a), "%lu", expected);
+		snprintf(b, sizeof(b), "%lu", got);
+		mismatch(what, a, strlen(a), b, strlen(b));
+	}
+}
+
+/*
+ * stderr is pointed at a memory stream while one side runs, so the warnings both sides print can be compared
+ * only the stdio stream moves; sanitizer reports still go to file descriptor 2
+ */
+typedef struct Capture {
+	FILE *saved;
+	char *text;
+	size_t length;
+} Capture;
+
+static void capture_begin(Capture *capture){
+	fflush(stderr);
+	capture->saved = stderr;
+	stderr = open_memstream(&capture->text, &capture->length);
+	if(stderr == NULL){
+		stderr = capture->saved;
+		fprintf(stderr, "Error: unable to capture stderr.\n");
+		exit(1);
+	}
+}
+
+static void capture_end(Capture *capture){
+	fclose(stderr);
+	stderr = capture->saved;
+}
+
+/*
+ * the list row as db_list printed it with printf and strftime; a date localtime cannot convert prints as empty
+ */
+static void reference_list_record(FILE *file, Record const *record){
+	char dateStr[20] = "";
+	struct tm tm;
+	time_t date = record->dateLastModified;
+	if(localtime_r(&date, &tm) != NULL){
+		strftime(dateStr, sizeof(dateStr), "%Y-%m-%d %H:%M", &tm);
+	}
+	fprintf(file, "%-20.20s | %-10lu | %-19s | %-30.30s\n",
+	        record->handle, record->followerCount, dateStr, record->comment);
+}
+
+/*
+ * parse_record against parse_line on the line [line, end), which holds no newline
+ */
+static void check_line(char const *line, char const *end){
+	char *copy = malloc(end - line + 1);
+	if(copy == NULL){
+		fprintf(stderr, "Failed memory allocation.\n");
+		exit(1);
+	}
+	memcpy(copy, line, end - line);
+	copy[end - line] = '\0';
+
+	Capture reference, fast;
+	char comment[COMMENT_SIZE];
+	capture_begin(&reference);
+	Record expected = parse_record(copy, comment);
+	capture_end(&reference);
+
+	Record got;
+	char const *gotComment;
+	size_t gotCommentLength;
+	capture_begin(&fast);
+	report_parse_warnings(parse_line(line, end, &got, &gotComment, &gotCommentLength));
+	capture_end(&fast);
+
+	expect_bytes("parse_line handle", expected.handle, sizeof(expected.handle), got.handle, sizeof(got.handle));
+	expect_number("parse_line followerCount", expected.followerCount, got.followerCount);
+	expect_bytes("parse_line comment", expected.comment, strlen(expected.comment), gotComment, gotCommentLength);
+	expect_number("parse_line dateLastModified", expected.dateLastModified, got.dateLastModified);
+	expect_bytes("parse_line warnings", reference.text, reference.length, fast.text, fast.length);
+	free(reference.text);
+	free(fast.text);
+	free(copy);
+}
+
+/*
+ * the loader as it was before db_load_csv parsed in place: one parse_record and db_append per line
+ */
+static void reference_load(Database *db, char const *data, size_t size){
+	char const *end = data + size;
+	char comment[COMMENT_SIZE];
+	for(char const *line = data; line < end; ){
+		char const *newline = memchr(line, '\n', end - line);
+		char const *lineEnd = newline != NULL ? newline : end;
+		char *copy = malloc(lineEnd - line + 1);
+		if(copy == NULL){
+			fprintf(stderr, "Failed memory allocation.\n");
+			exit(1);
+		}
+		memcpy(copy, line, lineEnd - line);
+		copy[lineEnd - line] = '\0';
+		Record record = parse_record(copy, comment);
+		db_append(db, &record);
+		free(copy);
+		line = lineEnd + 1;
+	}
+}
+
+static void expect_same_tables(char const *what, Database *expected, Database *got){
+	expect_number(what, expected->size, got->size);
+	for(int i = 0; i < expected->size; i++){
+		Record const *x = &expected->records[i];
+		Record const *y = &got->records[i];
+		expect_bytes(what, x->handle, sizeof(x->handle), y->handle, sizeof(y->handle));
+		expect_number(what, x->followerCount, y->followerCount);
+		expect_bytes(what, x->comment, strlen(x->comment), y->comment, strlen(y->comment));
+		expect_number(what, x->dateLastModified, y->dateLastModified);
+		//duplicate handles must resolve to the same, first, record
+		expect_number(what, db_lookup(expected, x->handle) - expected->records, db_lookup(got, y->handle) - got->records);
+	}
+}
+
+/*
+ * @return everything written to the scratch file since it was last emptied, which the caller frees
+ */
+static char *read_back(int fd, size_t *length){
+	off_t size = lseek(fd, 0, SEEK_END);
+	char *text = malloc(size + 1);
+	if(text == NULL || pread(fd, text, size, 0) != size){
+		fprintf(stderr, "Error: unable to read back the output.\n");
+		exit(1);
+	}
+	*length = size;
+	if(ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0){
+		fprintf(stderr, "Error: unable to reset the output file.\n");
+		exit(1);
+	}
+	return text;
+}
+
+/*
+ * fprintf against the output engine for every record of the table
+ */
+static void check_output(Database *db){
+	static FILE *scratch = NULL; //OutBuf writes to a file descriptor, so its output goes through a temporary file
+	if(scratch == NULL && (scratch = tmpfile()) == NULL){
+		fprintf(stderr, "Error: unable to create a temporary file.\n");
+		exit(1);
+	}
+	int fd = fileno(scratch);
+
+	for(int format = 0; format < 2; format++){
+		char *expected;
+		size_t expectedLength;
+		FILE *reference = open_memstream(&expected, &expectedLength);
+		OutBuf out;
+		out_open(&out, fd);
+		for(int i = 0; i < db->size; i++){
+			if(format == 0){
+				fprintf(reference, "%s,%lu,%s,%lu\n", db->records[i].handle, db->records[i].followerCount,
+				        db->records[i].comment, db->records[i].dateLastModified);
+				out_csv_record(&out, &db->records[i]);
+			}else{
+				reference_list_record(reference, &db->records[i]);
+				out_list_record(&out, &db->records[i]);
+			}
+		}
+		fclose(reference);
+		out_close(&out);
+		size_t gotLength;
+		char *got = read_back(fd, &gotLength);
+		expect_bytes(format == 0 ? "out_csv_record" : "out_list_record", expected, expectedLength, got, gotLength);
+		free(expected);
+		free(got);
+	}
+}
+
+/*
+ * the block codec must give back its input, and must reject or bound any input it did not make
+ */
+static void check_codec(char const *data, size_t size){
+	size_t length = size < CODEC_BLOCK ? size : CODEC_BLOCK;
+	char *packed = malloc(codec_bound(length));
+	char *unpacked = malloc(length + 1);
+	if(packed == NULL || unpacked == NULL){
+		fprintf(stderr, "Failed memory allocation.\n");
+		exit(1);
+	}
+	size_t packedLength = codec_compress(data, length, packed);
+	if(packedLength > codec_bound(length)){
+		fprintf(stderr, "MISMATCH in codec_compress: %zu bytes exceed the bound\n", packedLength);
+		abort();
+	}
+	long unpackedLength = codec_decompress(packed, packedLength, unpacked, length);
+	expect_bytes("codec round trip", data, length, unpacked, unpackedLength < 0 ? 0 : unpackedLength);
+
+	//arbitrary bytes as a compressed block; the output buffer is exactly as large as allowed, so overruns show up
+	codec_decompress(data, length, unpacked, length);
+	free(packed);
+	free(unpacked);
+}
+
+static char *scratchDirectory = NULL;
+
+static void remove_scratch_directory(void){
+	rmdir(scratchDirectory);
+}
+
+/*
+ * @return the path of a database in a private temporary directory, whose journal the journal check writes
+ */
+static char const *scratch_database_path(void){
+	static char *dbPath = NULL;
+	if(dbPath == NULL){
+		char const *tmp = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+		scratchDirectory = malloc(strlen(tmp) + sizeof("/igdb-fuzz-XXXXXX"));
+		dbPath = malloc(strlen(tmp) + sizeof("/igdb-fuzz-XXXXXX/fuzz.csv"));
+		if(scratchDirectory == NULL || dbPath == NULL){
+			fprintf(stderr, "Failed memory allocation.\n");
+			exit(1);
+		}
+		sprintf(scratchDirectory, "%s/igdb-fuzz-XXXXXX", tmp);
+		if(mkdtemp(scratchDirectory) == NULL){
+			fprintf(stderr, "Error: unable to create a temporary directory.\n");
+			exit(1);
+		}
+		atexit(remove_scratch_directory);
+		sprintf(dbPath, "%s/fuzz.csv", scratchDirectory);
+	}
+	return dbPath;
+}
+
+/*
+ * every record journaled as an add must come back from a replay, in order and unchanged
+ * records the CSV entry cannot carry are left out: an empty handle or comment is skipped by the parser like any
+ * empty field, and only the first record of a handle is added
+ */
+static void check_journal(Database *db){
+	char const *dbPath = scratch_database_path();
+	char *path = journal_path(dbPath);
+	Journal journal;
+	Database expected = db_create();
+
+	unlink(path);
+	if(!journal_open(&journal, dbPath)){
+		exit(1);
+	}
+	for(int i = 0; i < db->size; i++){
+		Record const *record = &db->records[i];
+		if(record->handle[0] == '\0' || record->comment[0] == '\0' || db_lookup(&expected, record->handle) != NULL){
+			continue;
+		}
+		if(!journal_append(&journal, JOURNAL_ADD, record)){
+			fprintf(stderr, "MISMATCH in journal_append: entry for '%s' refused\n", record->handle);
+			abort();
+		}
+		db_append(&expected, record);
+	}
+	journal_close(&journal);
+
+	Database replayed = db_create();
+	Capture quiet;
+	capture_begin(&quiet);
+	journal_replay(&replayed, dbPath);
+	capture_end(&quiet);
+	expect_bytes("journal_replay warnings", "", 0, quiet.text, quiet.length);
+	free(quiet.text);
+	expect_same_tables("journal_replay", &expected, &replayed);
+
+	unlink(path);
+	free(path);
+	db_free(&expected);
+	db_free(&replayed);
+}
+
+/*
+ * deletes every handle in turn, and after each delete every row list still shows must be the one db_lookup finds for its
+ * handle or a later row of the same handle, so a handle the loaded file repeats stays reachable until its last row goes
+ */
+static void check_deletes(Database *db){
+	while(db_live_records(db) > 0){
+		int first = 0;
+		while(db_is_dead(db, first)){
+			first++;
+		}
+		char handle[sizeof(db->records[first].handle)];
+		strcpy(handle, db->records[first].handle);
+		expect_number("db_remove", 1, db_remove(db, handle));
+
+		for(int i = 0; i < db->size; i++){
+			if(db_is_dead(db, i)){
+				continue;
+			}
+			Record *found = db_lookup(db, db->records[i].handle);
+			if(found == NULL){
+				fprintf(stderr, "MISMATCH in db_remove: '%s' is listed but db_lookup misses it\n", db->records[i].handle);
+				abort();
+			}
+			int row = (int)(found - db->records);
+			if(row > i || db_is_dead(db, row) || strcmp(found->handle, db->records[i].handle) != 0){
+				fprintf(stderr, "MISMATCH in db_remove: '%s' at row %d is found at row %d\n", db->records[i].handle, i, row);
+				abort();
+			}
+		}
+	}
+}
+
+/*
+ * aggregate_histogram against a plain loop, with the bucket width db_histogram picks for 'buckets' buckets
+ */
+static void check_histogram(Database *db, int buckets){
+	if(db->size == 0){
+		return;
+	}
+	unsigned long lo = ULONG_MAX;
+	unsigned long hi = 0;
+	for(int i = 0; i < db->size; i++){
+		lo = db->records[i].followerCount < lo ? db->records[i].followerCount : lo;
+		hi = db->records[i].followerCount > hi ? db->records[i].followerCount : hi;
+	}
+	unsigned long width = (hi - lo) / buckets;
+	if(width < ULONG_MAX){
+		width++;
+	}
+
+	long *expected = calloc(buckets, sizeof(long));
+	long *got = malloc(buckets * sizeof(long));
+	if(expected == NULL || got == NULL){
+		fprintf(stderr, "Failed memory allocation.\n");
+		exit(1);
+	}
+	for(int i = 0; i < db->size; i++){
+		unsigned long bucket = (db->records[i].followerCount - lo) / width;
+		expected[bucket < (unsigned long)buckets ? bucket : (unsigned long)buckets - 1]++;
+	}
+	for(int threads = 1; threads <= 3; threads += 2){
+		aggregate_histogram(db, lo, width, buckets, got, threads);
+		for(int b = 0; b < buckets; b++){
+			expect_number("aggregate_histogram", expected[b], got[b]);
+		}
+	}
+	free(expected);
+	free(got);
+}
+
+int LLVMFuzzerTestOneInput(uint8_t const *data, size_t size){
+	char const *text = (char const *)data;
+	char const *end = text + size;
+
+	for(char const *line = text; line < end; ){
+		char const *newline = memchr(line, '\n', end - line);
+		char const *lineEnd = newline != NULL ? newline : end;
+		check_line(line, lineEnd);
+		line = lineEnd + 1;
+	}
+
+	Database expected = db_create();
+	Database got = db_create();
+	Capture quiet; //warnings were compared line by line already
+	capture_begin(&quiet);
+	reference_load(&expected, text, size);
+	db_load_buffer(&got, text, size);
+	capture_end(&quiet);
+	free(quiet.text);
+	expect_same_tables("db_load_buffer", &expected, &got);
+	if(size >= FUZZ_PARALLEL_BYTES){
+		Database parallel = db_create();
+		capture_begin(&quiet);
+		db_load_buffer_parallel(&parallel, text, size, 3);
+		capture_end(&quiet);
+		free(quiet.text);
+		expect_same_tables("db_load_buffer_parallel", &expected, &parallel);
+		db_free(&parallel);
+	}
+	check_output(&got);
+	check_histogram(&got, 1 + (int)(size % 7));
+	if(size < FUZZ_PARALLEL_BYTES){ //an fdatasync per entry would make the large input take minutes
+		check_journal(&got);
+	}
+	check_codec(text, size);
+	if(size < FUZZ_PARALLEL_BYTES){ //quadratic in the rows
+		check_deletes(&got);
+	}
+
+	db_free(&expected);
+	db_free(&got);
+	return 0;
+}
+
+#ifdef FUZZ_DRIVER
+
+/*
+ * appends one field that tends to hit an edge of the parsers: overlong, empty, signed, overflowing, spaced or binary
+ */
+static size_t random_field(char *out){
+	static char const *const numbers[] = {
+		"0", "42", "-1", "+7", " 12", "\t5", "18446744073709551615", "18446744073709551616", "99999999999999999999999",
+		"12abc", "abc", "", "-", "+", " ", "0x10", "1e5", "-18446744073709551615", "0009", "\v3"
+	};
+	size_t length = 0;
+	switch(rand() % 6){
+	case 0:
+	case 1: { //a number, usually a tricky one
+		char const *number = numbers[rand() % (sizeof(numbers) / sizeof(numbers[0]))];
+		length = strlen(number);
+		memcpy(out, number, length);
+		break;
+	}
+	case 2: //text around the handle and comment limits
+	case 3: {
+		size_t limits[] = { 0, 1, 19, 20, 21, 29, 30, 31, 32, 33, 62, 63, 64, 65, 100 };
+		length = limits[rand() % (sizeof(limits) / sizeof(limits[0]))];
+		for(size_t i = 0; i < length; i++){
+			out[i] = i == 0 && rand() % 2 ? '@' : 'a' + rand() % 26;
+		}
+		break;
+	}
+	case 4: //bytes that mean something to somebody
+		length = rand() % 8;
+		for(size_t i = 0; i < length; i++){
+			static char const special[] = { '\0', '\r', '\t', ' ', '"', '%', '\\', (char)0xff, (char)0xc3, '-' };
+			out[i] = special[rand() % sizeof(special)];
+		}
+		break;
+	default: //anything at all
+		length = rand() % 12;
+		for(size_t i = 0; i < length; i++){
+			out[i] = (char)(rand() % 256);
+		}
+	}
+	return length;
+}
+
+/*
+ * builds a CSV input of a few lines with missing, doubled and extra commas
+ * @return its length
+ */
+static size_t random_input(char *out, int lines){
+	size_t length = 0;
+	for(int l = 0; l < lines; l++){
+		int fields = rand() % 7;
+		for(int f = 0; f < fields; f++){
+			if(f > 0){
+				int commas = rand() % 8 == 0 ? 2 : 1;
+				while(commas-- > 0){
+					out[length++] = ',';
+				}
+			}
+			length += random_field(out + length);
+		}
+		if(l < lines - 1 || rand() % 2){
+			out[length++] = '\n';
+		}
+	}
+	return length;
+}
+
+/*
+ * @return the contents of 'path', "-" for standard input, or NULL if it cannot be read
+ */
+static char *read_input(char const *path, size_t *size){
+	FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+	if(file == NULL){
+		return NULL;
+	}
+	size_t capacity = 4096;
+	char *data = malloc(capacity);
+	*size = 0;
+	size_t got;
+	while(data != NULL && (got = fread(data + *size, 1, capacity - *size, file)) > 0){
+		*size += got;
+		if(*size == capacity){
+			capacity *= 2;
+			char *grown = realloc(data, capacity);
+			if(grown == NULL){
+				free(data); //the loop ends and the caller reports the input as unreadable
+			}
+			data = grown;
+		}
+	}
+	if(file != stdin){
+		fclose(file);
+	}
+	return data;
+}
+
+int main(int argc, char **argv){
+	//the longest journal entry there is, followed by one that must not be glued onto it
+	static char const longest[] =
+		"@abcdefghijklmnopqrstuvwxyz0123,18446744073709551615,"
+		"abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghijk,18446744073709551615\n"
+		"@next,1,short,2\n";
+	Database db = db_create();
+	db_load_buffer(&db, longest, sizeof(longest) - 1);
+	check_journal(&db);
+	db_free(&db);
+
+	//the widest range there is, in one bucket: the width cannot be rounded up to cover it
+	static char const extremes[] = "@zero,0,low,1\n@max,18446744073709551615,high,2\n";
+	db = db_create();
+	db_load_buffer(&db, extremes, sizeof(extremes) - 1);
+	for(int buckets = 1; buckets <= 3; buckets++){
+		check_histogram(&db, buckets);
+	}
+	db_free(&db);
+
+	//a handle the file repeats: deleting the indexed row must leave the later ones reachable
+	static char const repeated[] = "@dup,1,first,1\n@other,2,b,2\n@dup,3,second,3\n@dup,4,third,4\n";
+	db = db_create();
+	db_load_buffer(&db, repeated, sizeof(repeated) - 1);
+	check_deletes(&db);
+	db_free(&db);
+
+	if(argc > 1){
+		for(int i = 1; i < argc; i++){
+			size_t size;
+			char *data = read_input(argv[i], &size);
+			if(data == NULL){
+				fprintf(stderr, "Error: unable to read '%s'.\n", argv[i]);
+				return 1;
+			}
+			LLVMFuzzerTestOneInput((uint8_t const *)data, size);
+			free(data);
+		}
+		printf("%d inputs match.\n", argc - 1);
+		return 0;
+	}
+
+	//a line is at most 6 fields of 100 bytes and their commas
+	char *data = malloc(FUZZ_PARALLEL_BYTES + 1024);
+	if(data == NULL){
+		fprintf(stderr, "Failed memory allocation.\n");
+		return 1;
+	}
+	srand(1);
+	for(int i = 0; i < DIFFTEST_ITERATIONS; i++){
+		size_t size = random_input(data, 1 + rand() % 8);
+		LLVMFuzzerTestOneInput((uint8_t const *)data, size);
+	}
+	//one input large enough for the parallel loader
+	size_t size = 0;
+	while(size < FUZZ_PARALLEL_BYTES){
+		size += random_input(data + size, 1);
+		data[size++] = '\n';
+	}
+	LLVMFuzzerTestOneInput((uint8_t const *)data, size);
+	free(data);
+	printf("%d generated inputs match.\n", DIFFTEST_ITERATIONS + 1);
+	return 0;
+}
+
+#endif
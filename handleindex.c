@@ -0,0 +1,387 @@
+#define _GNU_SOURCE //qsort_r
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "handleindex.h"
+
+//the pending list of a PrefixIndex never merges below this size
+#define PREFIX_MIN_PENDING 1024
+
+static void *checked_realloc(void *ptr, size_t bytes){
+	ptr = realloc(ptr, bytes);
+	if(ptr == NULL){
+		fprintf(stderr, "Failed to allocate memory for index.\n");
+		exit(1);
+	}
+	return ptr;
+}
+
+/*
+ * orders record numbers by handle and then by record number
+ * @param *arg the records the numbers point into
+ */
+static int compare_handles(void const *a, void const *b, void *arg){
+	Record const *records = arg;
+	int x = *(int const *)a;
+	int y = *(int const *)b;
+	int order = strcmp(records[x].handle, records[y].handle);
+	if(order != 0){
+		return order;
+	}
+	return (x > y) - (x < y);
+}
+
+/*
+ * @return how many records may wait in the pending list before it is merged into a sorted part of 'sorted' entries
+ */
+static int pending_limit(int sorted){
+	int root = 1;
+	while((long)root * root < sorted){
+		root++;
+	}
+	return PREFIX_MIN_PENDING + 4 * root;
+}
+
+/*
+ * sorts the pending list and merges it into the sorted part, walking both from the back so no scratch array is needed
+ */
+static void prefix_merge(PrefixIndex *index, Record const *records){
+	qsort_r(index->pending, index->pendingCount, sizeof(int), compare_handles, (void *)records);
+
+	int total = index->sortedCount + index->pendingCount;
+	index->sorted = checked_realloc(index->sorted, (total + 1) * sizeof(int));
+	int i = index->sortedCount - 1;
+	int j = index->pendingCount - 1;
+	for(int k = total - 1; j >= 0; k--){
+		if(i >= 0 && compare_handles(&index->sorted[i], &index->pending[j], (void *)records) > 0){
+			index->sorted[k] = index->sorted[i--];
+		}else{
+			index->sorted[k] = index->pending[j--];
+		}
+	}
+	index->sortedCount = total;
+	index->pendingCount = 0;
+}
+
+/*
+ * builds a prefix index over the first 'size' records
+ */
+PrefixIndex *prefix_build(Record const *records, int size){
+	PrefixIndex *index = malloc(sizeof(PrefixIndex));
+	if(index == NULL){
+		fprintf(stderr, "Failed to allocate memory for index.\n");
+		exit(1);
+	}
+	index->sorted = checked_realloc(NULL, (size + 1) * sizeof(int));
+	for(int i = 0; i < size; i++){
+		index->sorted[i] = i;
+	}
+	qsort_r(index->sorted, size, sizeof(int), compare_handles, (void *)records);
+	index->sortedCount = size;
+	index->pendingCapacity = PREFIX_MIN_PENDING;
+	index->pending = checked_realloc(NULL, index->pendingCapacity * sizeof(int));
+	index->pendingCount = 0;
+	return index;
+}
+
+/*
+ * adds record 'id' to the index
+ */
+void prefix_add(PrefixIndex *index, Record const *records, int id){
+	if(index->pendingCount == index->pendingCapacity){
+		index->pendingCapacity *= 2;
+		index->pending = checked_realloc(index->pending, index->pendingCapacity * sizeof(int));
+	}
+	index->pending[index->pendingCount++] = id;
+	if(index->pendingCount > pending_limit(index->sortedCount)){
+		prefix_merge(index, records);
+	}
+}
+
+/*
+ * finds every record whose handle starts with 'prefix'
+ * @param **ids set to a malloc'd array of the matching record numbers ordered by handle, the caller frees it
+ * @return the number of matches
+ */
+int prefix_find(PrefixIndex const *index, Record const *records, char const *prefix, int **ids){
+	size_t length = strlen(prefix);
+
+	//binary search for the first handle that is not below the prefix
+	int lo = 0;
+	int hi = index->sortedCount;
+	while(lo < hi){
+		int mid = lo + (hi - lo) / 2;
+		if(strcmp(records[index->sorted[mid]].handle, prefix) < 0){
+			lo = mid + 1;
+		}else{
+			hi = mid;
+		}
+	}
+	int end = lo;
+	while(end < index->sortedCount && strncmp(records[index->sorted[end]].handle, prefix, length) == 0){
+		end++;
+	}
+
+	int *pending = checked_realloc(NULL, (index->pendingCount + 1) * sizeof(int));
+	int pendingCount = 0;
+	for(int i = 0; i < index->pendingCount; i++){
+		if(strncmp(records[index->pending[i]].handle, prefix, length) == 0){
+			pending[pendingCount++] = index->pending[i];
+		}
+	}
+	qsort_r(pending, pendingCount, sizeof(int), compare_handles, (void *)records);
+
+	//both runs are in handle order, so merging them keeps it
+	int count = end - lo + pendingCount;
+	int *found = checked_realloc(NULL, (count + 1) * sizeof(int));
+	int i = lo;
+	int j = 0;
+	for(int k = 0; k < count; k++){
+		if(j == pendingCount || (i < end && compare_handles(&index->sorted[i], &pending[j], (void *)records) < 0)){
+			found[k] = index->sorted[i++];
+		}else{
+			found[k] = pending[j++];
+		}
+	}
+	free(pending);
+	*ids = found;
+	return count;
+}
+
+void prefix_free(PrefixIndex *index){
+	if(index == NULL){
+		return;
+	}
+	free(index->sorted);
+	free(index->pending);
+	free(index);
+}
+
+/*
+ * packs three bytes of a handle into a trigram, never 0 since handles hold no NUL bytes
+ */
+static unsigned int pack_trigram(char const *text){
+	unsigned char const *bytes = (unsigned char const *)text;
+	return (unsigned int)bytes[0] << 16 | (unsigned int)bytes[1] << 8 | bytes[2];
+}
+
+static unsigned int trigram_slot(unsigned int trigram, int capacity){
+	unsigned int hash = trigram * 2654435761u;
+	return (hash ^ hash >> 15) & (capacity - 1);
+}
+
+/*
+ * @return the posting list of 'trigram', or NULL if no handle contains it
+ */
+static Posting *trigram_lookup(TrigramIndex const *index, unsigned int trigram){
+	unsigned int mask = index->capacity - 1;
+	for(unsigned int slot = trigram_slot(trigram, index->capacity); index->table[slot].trigram != 0; slot = (slot + 1) & mask){
+		if(index->table[slot].trigram == trigram){
+			return &index->table[slot];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * doubles the table, moving each posting list to its new slot
+ */
+static void trigram_grow(TrigramIndex *index){
+	Posting *old = index->table;
+	int oldCapacity = index->capacity;
+
+	index->capacity *= 2;
+	index->table = calloc(index->capacity, sizeof(Posting));
+	if(index->table == NULL){
+		fprintf(stderr, "Failed to allocate memory for index.\n");
+		exit(1);
+	}
+	unsigned int mask = index->capacity - 1;
+	for(int i = 0; i < oldCapacity; i++){
+		if(old[i].trigram == 0){
+			continue;
+		}
+		unsigned int slot = trigram_slot(old[i].trigram, index->capacity);
+		while(index->table[slot].trigram != 0){
+			slot = (slot + 1) & mask;
+		}
+		index->table[slot] = old[i];
+	}
+	free(old);
+}
+
+/*
+ * @return the posting list of 'trigram', adding an empty one if there is none yet
+ */
+static Posting *trigram_insert(TrigramIndex *index, unsigned int trigram){
+	if((index->used + 1) * 2 > index->capacity){
+		trigram_grow(index);
+	}
+	unsigned int mask = index->capacity - 1;
+	unsigned int slot = trigram_slot(trigram, index->capacity);
+	while(index->table[slot].trigram != 0){
+		if(index->table[slot].trigram == trigram){
+			return &index->table[slot];
+		}
+		slot = (slot + 1) & mask;
+	}
+	index->table[slot].trigram = trigram;
+	index->used++;
+	return &index->table[slot];
+}
+
+/*
+ * builds a trigram index over the first 'size' records
+ */
+TrigramIndex *trigram_build(Record const *records, int size){
+	TrigramIndex *index = malloc(sizeof(TrigramIndex));
+	if(index == NULL){
+		fprintf(stderr, "Failed to allocate memory for index.\n");
+		exit(1);
+	}
+	index->capacity = 1024;
+	index->used = 0;
+	index->table = calloc(index->capacity, sizeof(Posting));
+	if(index->table == NULL){
+		fprintf(stderr, "Failed to allocate memory for index.\n");
+		exit(1);
+	}
+	for(int i = 0; i < size; i++){
+		trigram_add(index, records, i);
+	}
+	return index;
+}
+
+/*
+ * adds record 'id' to the posting list of every trigram in its handle
+ * ids must be added in ascending order so the lists stay sorted
+ */
+void trigram_add(TrigramIndex *index, Record const *records, int id){
+	char const *handle = records[id].handle;
+	size_t length = strnlen(handle, sizeof(records[id].handle));
+
+	for(size_t i = 0; i + 3 <= length; i++){
+		Posting *posting = trigram_insert(index, pack_trigram(handle + i));
+		if(posting->count > 0 && posting->ids[posting->count - 1] == id){
+			continue; //trigram repeats inside this handle
+		}
+		if(posting->count == posting->capacity){
+			posting->capacity = posting->capacity == 0 ? 4 : posting->capacity * 2;
+			posting->ids = checked_realloc(posting->ids, posting->capacity * sizeof(int));
+		}
+		posting->ids[posting->count++] = id;
+	}
+}
+
+/*
+ * @return the first position at or after 'from' in the sorted list whose id is not below 'id'
+ */
+int posting_seek(int const *ids, int from, int count, int id){
+	//gallop forward, then binary search the last step
+	int step = 1;
+	int hi = from;
+	while(hi < count && ids[hi] < id){
+		from = hi + 1;
+		hi += step;
+		step *= 2;
+	}
+	if(hi > count){
+		hi = count;
+	}
+	while(from < hi){
+		int mid = from + (hi - from) / 2;
+		if(ids[mid] < id){
+			from = mid + 1;
+		}else{
+			hi = mid;
+		}
+	}
+	return from;
+}
+
+/*
+ * finds every record whose handle contains 'substring'
+ * candidates come from intersecting the posting lists of the substring's trigrams and are confirmed with strstr;
+ * substrings shorter than a trigram match too much for an index to help, so they scan every handle
+ * @param int size number of records
+ * @param **ids set to a malloc'd array of the matching record numbers in ascending order, the caller frees it
+ * @return the number of matches
+ */
+int trigram_grep(TrigramIndex const *index, Record const *records, int size, char const *substring, int **ids){
+	size_t length = strlen(substring);
+	int *found;
+	int count = 0;
+
+	if(length < 3){
+		found = checked_realloc(NULL, (size + 1) * sizeof(int));
+		for(int i = 0; i < size; i++){
+			if(strstr(records[i].handle, substring) != NULL){
+				found[count++] = i;
+			}
+		}
+		*ids = found;
+		return count;
+	}
+	if(length >= sizeof(records[0].handle)){
+		*ids = checked_realloc(NULL, sizeof(int));
+		return 0;
+	}
+
+	//start from the shortest list, any trigram no handle has means no match
+	Posting const *lists[sizeof(records[0].handle)];
+	int listCount = 0;
+	int shortest = 0;
+	for(size_t i = 0; i + 3 <= length; i++){
+		Posting const *posting = trigram_lookup(index, pack_trigram(substring + i));
+		if(posting == NULL){
+			*ids = checked_realloc(NULL, sizeof(int));
+			return 0;
+		}
+		if(listCount == 0 || posting->count < lists[shortest]->count){
+			shortest = listCount;
+		}
+		lists[listCount++] = posting;
+	}
+
+	found = checked_realloc(NULL, (lists[shortest]->count + 1) * sizeof(int));
+	memcpy(found, lists[shortest]->ids, lists[shortest]->count * sizeof(int));
+	count = lists[shortest]->count;
+	for(int l = 0; l < listCount && count > 0; l++){
+		if(lists[l] == lists[shortest]){
+			continue;
+		}
+		int kept = 0;
+		int position = 0;
+		for(int i = 0; i < count; i++){
+			position = posting_seek(lists[l]->ids, position, lists[l]->count, found[i]);
+			if(position == lists[l]->count){
+				break;
+			}
+			if(lists[l]->ids[position] == found[i]){
+				found[kept++] = found[i];
+			}
+		}
+		count = kept;
+	}
+
+	//sharing every trigram does not mean the trigrams are adjacent
+	int kept = 0;
+	for(int i = 0; i < count; i++){
+		if(strstr(records[found[i]].handle, substring) != NULL){
+			found[kept++] = found[i];
+		}
+	}
+	*ids = found;
+	return kept;
+}
+
+void trigram_free(TrigramIndex *index){
+	if(index == NULL){
+		return;
+	}
+	for(int i = 0; i < index->capacity; i++){
+		free(index->table[i].ids);
+	}
+	free(index->table);
+	free(index);
+}
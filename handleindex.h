@@ -0,0 +1,56 @@
+#ifndef HANDLEINDEX_H
+#define HANDLEINDEX_H
+
+#include "database.h"
+
+/*
+ * record numbers ordered by handle, for prefix search
+ * new records go to a small unsorted pending list that is sorted and merged in once it grows past
+ * a few times the square root of the sorted part, so appends stay cheap and a search scans at most that many extras
+ */
+typedef struct PrefixIndex {
+ int *sorted; //record numbers ordered by handle and then by record number
+ int sortedCount;
+ int *pending; //record numbers added since the last merge, in insertion order
+ int pendingCount;
+ int pendingCapacity;
+} PrefixIndex;
+
+/*
+ * record numbers of every handle containing one trigram, in ascending order
+ */
+typedef struct Posting {
+ unsigned int trigram; //three bytes of a handle packed big end first, 0 if the slot is empty
+ int count;
+ int capacity;
+ int *ids;
+} Posting;
+
+/*
+ * open addressing table from each trigram that occurs in some handle to its posting list, for substring search
+ */
+typedef struct TrigramIndex {
+ Posting *table;
+ int capacity; //number of slots, always a power of two
+ int used; //number of occupied slots
+} TrigramIndex;
+
+PrefixIndex *prefix_build(Record const * records, int size);
+
+void prefix_add(PrefixIndex * index, Record const * records, int id);
+
+int prefix_find(PrefixIndex const * index, Record const * records, char const * prefix, int ** ids);
+
+void prefix_free(PrefixIndex * index);
+
+TrigramIndex *trigram_build(Record const * records, int size);
+
+void trigram_add(TrigramIndex * index, Record const * records, int id);
+
+int trigram_grep(TrigramIndex const * index, Record const * records, int size, char const * substring, int ** ids);
+
+void trigram_free(TrigramIndex * index);
+
+int posting_seek(int const * ids, int from, int count, int id);
+
+#endif
@@ -4,21 +4,56 @@
 #include <time.h>
 #include <ctype.h>
 #include "database.h"
+#include "snapshot.h"
+#include "journal.h"
+#include "output.h"
+#include "server.h"
+#include "igdb.h"
+#include "stats.h"
+#include "aggregate.h"
+#include "merge.h"
+#include "codec.h"
+#include "undo.h"
 #include <errno.h>
 #include <limits.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+
+//file the database was loaded from and is saved back to, in the format it was loaded in
+static char const *dbPath = "database.csv";
+static int dbIsSnapshot = 0;
+static int dbIsCompressed = 0; //CSV saved through the block compressor, see codec.h
+
+//threads the database file is parsed on, also used for files read by 'merge'
+static int loadThreads = 1;
+
+//with journaling on every change is appended to dbPath.journal before it is acknowledged
+static Journal journal = { -1, NULL, 0 };
+static int journalEnabled = 0;
+
+//the journal is folded into the database file once it holds this many entries and at least one per record
+#define JOURNAL_COMPACT_ENTRIES 10000
+
+//changes 'undo' and 'rollback' can revert, made at the interactive prompt
+static UndoHistory undoHistory;
+
+//number of changes that were not journaled, so a save that finishes later can tell whether it covered all of them
+static unsigned long memoryChanges = 0;
+
+//save running in a child process, started by 'save' in the interactive loop; savePid is -1 when there is none
+static pid_t savePid = -1;
+static int *saveFlag; //cleared when the save finishes if nothing changed in memory since it started
+static unsigned long saveChanges; //memoryChanges when the child was forked
+static int saveRecords;
+static off_t saveJournalOffset; //journal entries before this byte are in the file the child writes
+static long saveJournalEntries;
 
 //simple printing of prompt
 void print_prompt() {
         printf("> ");
 }
-/*
- *properly formats the timestamp in a record to be readable by a human
- */
-void format_date(char* buffer, size_t buffer_size, time_t date) {
-    struct tm* timeinfo = localtime(&date);
-    strftime(buffer, buffer_size, "%Y-%m-%d %H:%M", timeinfo);
-}
-
 
 /*
  * returns current time in timestamp form 
@@ -32,27 +67,231 @@ time_t current_time(){
   return cur_time;
 }
 
+/*
+ * starts a listing on standard output
+ * anything printf still holds is flushed first so the two streams stay in order
+ */
+void list_begin(OutBuf *out) {
+    fflush(stdout);
+    out_open(out, STDOUT_FILENO);
+}
+
 /*
  * lists the database
+ * @param *out where the table is written
+ * @param offset number of records to skip
+ * @param limit maximum number of records to print
+ */
+void db_list(Database* db, OutBuf *out, unsigned long offset, unsigned long limit) {
+    size_t i = 0;
+    if (db->deadCount == 0) { //without deleted records the offset is a position
+        i = offset;
+        offset = 0;
+    }
+    out_list_header(out);
+    for (; i < db->size && limit > 0; i++) { //loops over database
+        if (db_is_dead(db, i)) {
+            continue;
+        }
+        if (offset > 0) {
+            offset--;
+            continue;
+        }
+        out_list_record(out, &db->records[i]);
+        limit--;
+    }
+}
+
+/*
+ * lists the n records with the most followers, most followers first
+ * walks back from the end of the followers index, so it costs O(log n + k) once the index exists
+ */
+void db_top(Database *db, OutBuf *out, unsigned long n) {
+    out_list_header(out);
+    SortedNode *node = sorted_last(db_followers_index(db));
+    for (unsigned long i = 0; i < n && node != NULL; i++) {
+        out_list_record(out, &db->records[node->id]);
+        node = sorted_prev(node);
+    }
+}
+
+/*
+ * lists the records with between lo and hi followers inclusive, fewest followers first
  */
-void db_list(Database* db) {
-    printf("HANDLE               | FOLLOWERS  | LAST MODIFIED       | COMMENT\n"); //column names
-    printf("-----------------------------------------------------------------------------\n");
+void db_range(Database *db, OutBuf *out, unsigned long lo, unsigned long hi) {
+    out_list_header(out);
+    for (SortedNode *node = sorted_seek(db_followers_index(db), lo); node != NULL && node->key <= hi; node = sorted_next(node)) {
+        out_list_record(out, &db->records[node->id]);
+    }
+}
 
-    for (size_t i = 0; i < db->size; i++) { //loops over database
-        Record record = db->records[i];
-        char dateStr[20];
-        format_date(dateStr, sizeof(dateStr), record.dateLastModified); //formats date for each record
+/*
+ * lists the records modified at or after 'since', oldest change first
+ * seeks into the modification time index, so it costs O(log n + k)
+ */
+void db_since(Database *db, OutBuf *out, unsigned long since) {
+    out_list_header(out);
+    for (SortedNode *node = sorted_seek(db_dates_index(db), since); node != NULL; node = sorted_next(node)) {
+        out_list_record(out, &db->records[node->id]);
+    }
+}
 
-        // Truncate handle and comment if they exceed their column widths
-        printf("%-20.20s | %-10lu | %-19s | %-30.30s\n", //truncates handle to only 20 characters, long integers should only be 10 digits, date should be 19, and comment will be truncated after 30 characters
-               record.handle,
-               record.followerCount,
-               dateStr,
-               record.comment);
+/*
+ * lists the records whose handle starts with 'prefix', in handle order
+ * binary searches the handle index, so it costs O(log n + k) once the index exists
+ */
+void db_find(Database *db, OutBuf *out, char const *prefix) {
+    int *ids;
+    int count = db_find_prefix(db, prefix, &ids);
+    out_list_header(out);
+    for (int i = 0; i < count; i++) {
+        out_list_record(out, &db->records[ids[i]]);
     }
+    free(ids);
 }
 
+/*
+ * lists the records whose handle contains 'substring', in database order
+ */
+void db_grep(Database *db, OutBuf *out, char const *substring) {
+    int *ids;
+    int count = db_grep_handles(db, substring, &ids);
+    out_list_header(out);
+    for (int i = 0; i < count; i++) {
+        out_list_record(out, &db->records[ids[i]]);
+    }
+    free(ids);
+}
+
+
+/*
+ * lists the records whose comment holds every word of 'query', in database order
+ * @return 0 if the query holds no words and nothing was listed, 1 otherwise
+ */
+int db_search(Database *db, OutBuf *out, char const *query) {
+    int *ids;
+    int count = db_search_comments(db, query, &ids);
+    if (count < 0) {
+        return 0;
+    }
+    out_list_header(out);
+    for (int i = 0; i < count; i++) {
+        out_list_record(out, &db->records[ids[i]]);
+    }
+    free(ids);
+    return 1;
+}
+
+/*
+ * appends an unsigned 128 bit number in decimal
+ */
+static void out_uint128(OutBuf *out, unsigned __int128 value) {
+    char digits[40];
+    char *p = digits + sizeof(digits);
+    do {
+        *--p = '0' + (int)(value % 10);
+        value /= 10;
+    } while (value != 0);
+    out_write(out, p, digits + sizeof(digits) - p);
+}
+
+/*
+ * prints the count, total, mean, median and extremes of followerCount and the oldest and newest change
+ * the totals come from one vectorized pass, the median from a selection over a copy of the counts
+ */
+void db_stats_followers(Database *db, OutBuf *out) {
+    Aggregate total;
+    aggregate_records(db, &total, 0);
+    out_str(out, "Records: ");
+    out_ulong(out, total.count, 0);
+    out_write(out, "\n", 1);
+    if (total.count == 0) {
+        return;
+    }
+    char number[64];
+    out_str(out, "Total followers: ");
+    out_uint128(out, total.followerSum);
+    snprintf(number, sizeof(number), "%.2Lf", (long double)total.followerSum / total.count);
+    out_str(out, "\nMean followers: ");
+    out_str(out, number);
+    snprintf(number, sizeof(number), "%.1Lf", aggregate_median(db));
+    out_str(out, "\nMedian followers: ");
+    out_str(out, number);
+    out_str(out, "\nMin followers: ");
+    out_ulong(out, total.followerMin, 0);
+    out_str(out, "\nMax followers: ");
+    out_ulong(out, total.followerMax, 0);
+    out_str(out, "\nOldest change: ");
+    out_date(out, total.dateMin, 0);
+    out_str(out, "\nNewest change: ");
+    out_date(out, total.dateMax, 0);
+    out_write(out, "\n", 1);
+}
+
+/*
+ * prints how many records fall in each of 'buckets' equal ranges of followerCount between the smallest and largest count
+ * buckets past the largest count are left out when there are fewer distinct counts than buckets
+ */
+void db_histogram(Database *db, OutBuf *out, int buckets) {
+    Aggregate total;
+    aggregate_records(db, &total, 0);
+    if (total.count == 0) {
+        out_str(out, "Records: 0\n");
+        return;
+    }
+    unsigned long width = (total.followerMax - total.followerMin) / buckets;
+    if (width < ULONG_MAX) {
+        width++;
+    }
+    long *counts = malloc(buckets * sizeof(long));
+    if (counts == NULL) {
+        fprintf(stderr, "Failed memory allocation.\n");
+        exit(1);
+    }
+    aggregate_histogram(db, total.followerMin, width, buckets, counts, 0);
+    //the width is rounded up, so the top buckets can be empty; it cannot be rounded up past ULONG_MAX, in which case
+    //the last bucket also takes the maximum
+    unsigned long span = (total.followerMax - total.followerMin) / width;
+    int used = span < (unsigned long)buckets ? (int)span + 1 : buckets;
+    for (int b = 0; b < used; b++) {
+        unsigned __int128 lo = total.followerMin + (unsigned __int128)b * width;
+        unsigned __int128 hi = lo + width - 1;
+        if (b == used - 1 && hi < total.followerMax) {
+            hi = total.followerMax;
+        }
+        out_ulong(out, (unsigned long)lo, 0);
+        out_write(out, "-", 1);
+        out_ulong(out, hi > ULONG_MAX ? ULONG_MAX : (unsigned long)hi, 0);
+        out_write(out, ": ", 2);
+        out_ulong(out, counts[b], 0);
+        out_write(out, "\n", 1);
+    }
+    free(counts);
+}
+
+/*
+ * merges the CSV file at 'path' into the database, newer rows winning, and reports the counts
+ * a merge can touch millions of records, so with journaling on it is saved as a whole rather than journaled row by row
+ * @return 0 if the file could not be read, 1 otherwise
+ */
+int db_merge(Database *db, OutBuf *out, char const *path, int *flag) {
+    MergeResult result;
+    char message[256];
+    double start = now_seconds();
+    if (!merge_csv(db, path, loadThreads, &result)) {
+        return 0;
+    }
+    snprintf(message, sizeof(message), "Merged %ld rows from %.128s in %.3f s: %ld added, %ld updated, %ld kept.\n",
+             result.rows, path, now_seconds() - start, result.added, result.updated, result.kept);
+    out_str(out, message);
+    if (result.added + result.updated > 0) {
+        if (!journalEnabled || !db_save(db)) {
+            *flag = 1;
+            memoryChanges++;
+        }
+    }
+    return 1;
+}
 
 /* checks if string has commas or whitespace
  * @param const char* str is a string that will be validated 
@@ -69,13 +308,33 @@ int validate_string(const char* str){
 	return 0;
 }
 
+/* checks a comment that has already been read, without its newline
+ * @param comment the comment to check
+ * @return NULL if the comment is valid, otherwise the reason it is not
+ */
+const char *check_comment(const char *comment) {
+    if (comment[0] == '\0' || comment[0] == ' ') {
+        return "Comment cannot be empty.";
+    }
+    if (strchr(comment, ',') != NULL) {
+        return "Comment cannot contain commas.";
+    }
+    // Check for valid ASCII range (32 to 127)
+    for (size_t i = 0; comment[i] != '\0'; i++) {
+        if ((unsigned char)comment[i] < 32 || (unsigned char)comment[i] > 126) {
+            return "Comment contains invalid characters.";
+        }
+    }
+    return NULL;
+}
+
 /* checks if the comment is valid
  * fgets works, comment is not a new line or null terminator or has commas or is empty
  * @param comment takes in comment and size of the comment
  * @return 0 if comment is valid and 1 is comment is valid
  *
  */
-int read_validated_comment(char* comment, size_t size) {
+static int prompt_comment(char* comment, size_t size) {
     printf("Comment> "); // Prompt user for comment
     if (fgets(comment, size, stdin) == NULL) { // Get user input
         fprintf(stderr, "Error reading comment.\n");
@@ -96,54 +355,127 @@ int read_validated_comment(char* comment, size_t size) {
         while((c = getchar()) != '\n' && c != EOF);
     }
 
-    // Check for commas in the comment
-    if (strchr(comment, ',') != NULL) {
-        fprintf(stderr, "Error: Comment cannot contain commas.\n");
+    // Check for commas and characters outside the printable ASCII range
+    const char *error = check_comment(comment);
+    if (error != NULL) {
+        fprintf(stderr, "Error: %s\n", error);
         return 0; // Failure
     }
 
-    // Check for valid ASCII range (32 to 127)
-    for(size_t i = 0; comment[i] != '\0'; i++) {
-        if ((unsigned char)comment[i] < 32 || (unsigned char)comment[i] > 126) {
-            fprintf(stderr, "Error: Comment contains invalid characters.\n");
-            return 0; // Failure
-        }
-    }
-
     return 1; // Success
 }
 
+/* prompts for a comment and checks it, see prompt_comment
+ * the time spent, mostly waiting for the user, is recorded in the statistics
+ * @return 1 if the comment is valid, 0 otherwise
+ */
+int read_validated_comment(char* comment, size_t size) {
+    unsigned long start = stat_now();
+    int ok = prompt_comment(comment, size);
+    stat_record(STAT_COMMENT_NS, stat_now() - start);
+    return ok;
+}
+
 /*
- * adds a new record to the database with a handle and follower count
+ * makes a change durable or remembers that it still has to be saved
+ * @param op JOURNAL_ADD, JOURNAL_UPDATE or JOURNAL_DELETE
+ * @param *record the record after the change
+ * @param int *flag set to 1 if the change is only in memory
  */
-void db_add(Database *db, const char* handle, unsigned long followerCount, int *flag){
-    //checks if handle already exists
-    if (db_lookup(db, handle)) {
-        fprintf(stderr, "Error: Handle '%s' already exists.\n", handle);
+void record_change(Database *db, char op, Record const *record, int *flag){
+    if (undoHistory.inTransaction) { //a transaction is journaled as a whole when it commits
+        if (!journalEnabled) {
+            *flag = 1;
+            memoryChanges++;
+        }
         return;
     }
-
-     if (handle[1] == '\0') {
-        fprintf(stderr, "Error: Handle cannot be empty.\n");
+    if (!journalEnabled || !journal_append(&journal, op, record)) {
+        *flag = 1; //database was modified and the change is not on disk yet
+        memoryChanges++;
         return;
     }
+
+    //compact once replaying the journal would cost about as much as reading the file again
+    if (journal.entries >= JOURNAL_COMPACT_ENTRIES && journal.entries >= db->size) {
+        db_save(db);
+    }
+}
+
+/* parses a follower count the way process_command does
+ * @param str the number as typed
+ * @param *value receives the count
+ * @return NULL on success, otherwise the reason the count is invalid
+ */
+const char *check_followers(const char *str, unsigned long *value) {
+    char *endptr;
+
+    if (str[0] == '-') {
+        return "follower count cannot be negative.";
+    }
+    errno = 0;
+    *value = strtoul(str, &endptr, 10);
+    if (errno == ERANGE && *value == ULONG_MAX) {
+        return "Follower count is too large.";
+    } else if (endptr == str) {
+        return "follower count must be an integer.";
+    } else if (*endptr != '\0') {
+        return "Extra characters after number.";
+    }
+    return NULL;
+}
+
+/* checks that a handle is well formed enough to be added
+ * @param handle the handle to check
+ * @return NULL if the handle is valid, otherwise the reason it is not
+ */
+const char *check_handle(const char *handle) {
+     if (handle[0] == '\0' || handle[1] == '\0') {
+        return "Handle cannot be empty.";
+    }
     //if handle does not start with '@' error message
      if (handle[0] != '@') {
-        fprintf(stderr, "Error: handle must start with '@'.\n");
-        return;
+        return "handle must start with '@'.";
     }
     
     //casts integer of 0 to pointer of Record just to get the size of the handle member of Record
     //check if the handle is too long
     if (strlen(handle) >= sizeof(((Record *)0)->handle)) {
-        fprintf(stderr, "Error: handle is too long.\n");
-        return;
+        return "handle is too long.";
     }
      
     //checks if handle is valid
     if(validate_string(handle)){
-	    fprintf(stderr, "Error: handle cannot contain commas or whitespace.\n");
-	    return;
+	    return "handle cannot contain commas or whitespace.";
+    }
+    return NULL;
+}
+
+/*
+ * remembers the state of a record before a change made at the prompt, so 'undo' or 'rollback' can restore it
+ * outside a transaction every change is a step of its own
+ */
+static void remember_change(char kind, Record const *before) {
+    undo_record(&undoHistory, kind, before);
+    if (!undoHistory.inTransaction) {
+        undo_push(&undoHistory);
+    }
+}
+
+/*
+ * adds a new record to the database with a handle and follower count
+ */
+void db_add(Database *db, const char* handle, unsigned long followerCount, int *flag){
+    //checks if handle already exists
+    if (db_lookup(db, handle)) {
+        fprintf(stderr, "Error: Handle '%s' already exists.\n", handle);
+        return;
+    }
+
+    const char *error = check_handle(handle);
+    if (error != NULL) {
+        fprintf(stderr, "Error: %s\n", error);
+        return;
     }
 
     Record newRecord = {0};
@@ -157,13 +489,30 @@ void db_add(Database *db, const char* handle, unsigned long followerCount, int *
     strncpy(newRecord.handle, handle, sizeof(newRecord.handle) - 1);
     newRecord.handle[sizeof(newRecord.handle) - 1] = '\0';
     newRecord.followerCount = followerCount;
-    strncpy(newRecord.comment, comment, sizeof(newRecord.comment) - 1);
-    newRecord.comment[sizeof(newRecord.comment) - 1] = '\0';
+    newRecord.comment = db_intern_comment(db, comment); //first 63 characters
     newRecord.dateLastModified = current_time();
 
     // Add the new record to the database
+    remember_change(JOURNAL_ADD, &newRecord);
     db_append(db, &newRecord);
-    *flag =1; //flag is one since database was modified
+    record_change(db, JOURNAL_ADD, &newRecord, flag);
+}
+/*
+ * deletes the record with 'handle' from the database
+ */
+void db_delete(Database *db, const char *handle, int *flag) {
+    Record *rec = db_lookup(db, handle);
+
+    if (rec == NULL) {
+        fprintf(stderr, "Error: no entry with handle %s\n", handle);
+        return;
+    }
+    Record removed = *rec; //the journal entry is written after the record is gone
+    char comment[COMMENT_SIZE]; //and so might its comment be
+    removed.comment = strcpy(comment, rec->comment);
+    remember_change(JOURNAL_DELETE, rec);
+    db_remove(db, handle);
+    record_change(db, JOURNAL_DELETE, &removed, flag);
 }
 /*
  * updates existing handle in the database
@@ -181,24 +530,135 @@ void db_update(Database *db, const char *handle, unsigned long follower, int *fl
             return;
     }
 
-    // copy comment into comment field (first 63 characters of the comment)
-    strncpy(rec->comment, comment, sizeof(rec->comment) - 1);
-    rec->comment[sizeof(rec->comment) - 1] = '\0';
+    // copy comment (first 63 characters), followerCount and time into the record
+    remember_change(JOURNAL_UPDATE, rec);
+    db_update_record(db, rec, follower, comment, current_time());
+    record_change(db, JOURNAL_UPDATE, rec, flag);
+}
+
+/*
+ * writes the database to a temporary file and renames it over dbPath, in the format it was loaded in
+ * @return 1 if the file was replaced, 0 otherwise
+ */
+static int write_database(Database *db) {
+    if (dbIsSnapshot) {
+        if (!snapshot_write(db, dbPath)) {
+            return 0;
+        }
+    } else {
+        char *tmpPath = malloc(strlen(dbPath) + sizeof(".tmp"));
+        if (tmpPath == NULL) {
+            fprintf(stderr, "Failed memory allocation.\n");
+            exit(1);
+        }
+        sprintf(tmpPath, "%s.tmp", dbPath);
+        int written = dbIsCompressed ? db_write_csv_compressed(db, tmpPath) : db_write_csv(db, tmpPath);
+        if (!written) {
+            //the database file and the journal are left as they were, so nothing is lost
+            unlink(tmpPath);
+            free(tmpPath);
+            return 0;
+        }
+        if (rename(tmpPath, dbPath) != 0) {
+            fprintf(stderr, "Error: unable to replace '%s'.\n", dbPath);
+            free(tmpPath);
+            return 0;
+        }
+        free(tmpPath);
+    }
+    return 1;
+}
+
+/*
+ * drops the journal entries a finished save wrote into the database file
+ * @param offset journal size when the save took its copy of the table
+ * @param long entries number of entries before offset
+ */
+static void saved_journal(off_t offset, long entries) {
+    if (journalEnabled) {
+        journal_trim(&journal, offset, entries); //entries appended while a background save ran are kept
+    } else {
+        char *path = journal_path(dbPath);
+        unlink(path);
+        free(path);
+    }
+}
+
+/*
+ * collects a background save that has finished, reporting it and clearing the unsaved changes flag
+ * if nothing changed in memory since it started
+ * @param int block 1 to wait for a save that is still running, 0 to return at once
+ */
+void save_poll(int block) {
+    int status;
 
-    // Update the followerCount
-    rec->followerCount = follower;
-    //Update time
-    rec->dateLastModified = current_time();
-    *flag = 1; //flag set to 1 since database was modified
+    if (savePid == -1) {
+        return;
+    }
+    pid_t done = waitpid(savePid, &status, block ? 0 : WNOHANG);
+    if (done == 0) {
+        return; //still writing
+    }
+    savePid = -1;
+    if (done == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Error: background save failed.\n");
+        return;
+    }
+    saved_journal(saveJournalOffset, saveJournalEntries);
+    if (memoryChanges == saveChanges) {
+        *saveFlag = 0;
+    }
+    printf("Wrote %d records.\n", saveRecords);
 }
 
 /*
  * saves database
+ * the file is replaced atomically and only then is the journal emptied, so a crash at any point loses nothing
+ * a background save still running is waited for first, so the two never share the temporary file
+ * @return 1 if the database was written, 0 otherwise
+ */
+int db_save(Database * db){
+    save_poll(1);
+    if (!write_database(db)) {
+        return 0;
+    }
+    saved_journal(journal_size(&journal), journal.entries);
+    printf("Wrote %d records.\n", db_live_records(db));
+    return 1;
+}
+
+/*
+ * saves the database without making the caller wait for the write
+ * a forked child writes the table as it was at the fork, the pages it shares with the parent being copy-on-write,
+ * and the parent keeps taking commands; save_poll reports the result once the child exits
+ * @param int *flag the unsaved changes flag, cleared by save_poll if the save still covers every change
+ * @return 1 if the save was started or, failing that, done in the foreground, 0 on failure
  */
-void db_save(Database * db){
-    db_write_csv(db, "database.csv");
-    printf("Wrote %d records.\n", db->size);
-};
+int db_save_background(Database *db, int *flag) {
+    save_poll(1); //one save at a time
+
+    saveJournalOffset = journal_size(&journal);
+    saveJournalEntries = journal.entries;
+    saveChanges = memoryChanges;
+    saveRecords = db_live_records(db);
+    fflush(stdout); //the child must not write out what the parent has buffered
+    pid_t pid = fork();
+    if (pid == -1) {
+        fprintf(stderr, "Warning: unable to save in the background, saving now.\n");
+        if (!db_save(db)) {
+            return 0;
+        }
+        *flag = 0;
+        return 1;
+    }
+    if (pid == 0) {
+        _exit(write_database(db) ? 0 : 1);
+    }
+    savePid = pid;
+    saveFlag = flag;
+    printf("Saving %d records in the background.\n", saveRecords);
+    return 1;
+}
 
 /*
  * handles exit
@@ -209,6 +669,14 @@ void db_save(Database * db){
 void handle_exit_command(Database *db, int *should_exit, int *flag) {
     char *arg = strtok(NULL, " \n"); // Attempt to get the next argument.
 
+    save_poll(1); //a save still running decides whether there are unsaved changes
+
+    // An open transaction is not journaled yet, so exiting would silently lose it.
+    if (undoHistory.inTransaction && (arg == NULL || strcmp(arg, "fr") != 0)) {
+        fprintf(stderr, "Error: commit or rollback the open transaction before exiting. Use 'exit fr' to discard it.\n");
+        return;
+    }
+
      if (arg == NULL && !*flag) {
         db_free(db); // Free database resources.
         *should_exit = 1; // Signal the main loop to exit.
@@ -229,7 +697,7 @@ void handle_exit_command(Database *db, int *should_exit, int *flag) {
     *should_exit = 1; // Signal the main loop to exit.
 }
 
-/* processes command for save, list, update, exit, add
+/* processes command for save, list, top, range, count, since, find, grep, search, stats, histogram, merge, begin, commit, rollback, undo, update, delete, exit, add, export, snapshot
  */
 void process_command(Database *db, char *input, int *should_exit, int *flag) {
     char *command = strtok(input, " \n"); // Extract the command.
@@ -242,12 +710,217 @@ void process_command(Database *db, char *input, int *should_exit, int *flag) {
 
     //find which command it is and act accordingly
     if (strcmp(command, "list") == 0) {
-        //"list" command.
-        if (strtok(NULL, " \n") != NULL) { //make sure no arguments following list
-            fprintf(stderr, "Error: 'list' command does not take any arguments.\n");
+        //"list [OFFSET [LIMIT]]" command.
+        char *offsetStr = strtok(NULL, " \n");
+        char *limitStr = offsetStr != NULL ? strtok(NULL, " \n") : NULL;
+        unsigned long offset = 0;
+        unsigned long limit = ULONG_MAX;
+        if (limitStr != NULL && strtok(NULL, " \n") != NULL) { //make sure nothing follows the limit
+            fprintf(stderr, "Error: usage: list [OFFSET [LIMIT]].\n");
 	    return;
+        }
+        if ((offsetStr != NULL && check_followers(offsetStr, &offset) != NULL)
+            || (limitStr != NULL && check_followers(limitStr, &limit) != NULL)) {
+            fprintf(stderr, "Error: OFFSET and LIMIT must be non-negative integers.\n");
+            return;
+        }
+        OutBuf out;
+        list_begin(&out);
+        db_list(db, &out, offset, limit);
+        out_close(&out);
+    } else if (strcmp(command, "top") == 0) {
+        //"top N" command.
+        char *countStr = strtok(NULL, " \n");
+        unsigned long count;
+        if (countStr == NULL || strtok(NULL, " \n") != NULL) {
+            fprintf(stderr, "Error: usage: top N.\n");
+            return;
+        }
+        const char *error = check_followers(countStr, &count);
+        if (error != NULL) {
+            fprintf(stderr, "Error: %s\n", error);
+            return;
+        }
+        OutBuf out;
+        list_begin(&out);
+        db_top(db, &out, count);
+        out_close(&out);
+    } else if (strcmp(command, "range") == 0) {
+        //"range LO HI" command.
+        char *loStr = strtok(NULL, " \n");
+        char *hiStr = strtok(NULL, " \n");
+        unsigned long lo, hi;
+        if (loStr == NULL || hiStr == NULL || strtok(NULL, " \n") != NULL) {
+            fprintf(stderr, "Error: usage: range LO HI.\n");
+            return;
+        }
+        const char *error = check_followers(loStr, &lo);
+        if (error == NULL) {
+            error = check_followers(hiStr, &hi);
+        }
+        if (error != NULL) {
+            fprintf(stderr, "Error: %s\n", error);
+            return;
+        }
+        OutBuf out;
+        list_begin(&out);
+        db_range(db, &out, lo, hi);
+        out_close(&out);
+    } else if (strcmp(command, "count") == 0) {
+        //"count LO HI" counts the records with between LO and HI followers
+        char *loStr = strtok(NULL, " \n");
+        char *hiStr = strtok(NULL, " \n");
+        unsigned long lo, hi;
+        if (loStr == NULL || hiStr == NULL || strtok(NULL, " \n") != NULL) {
+            fprintf(stderr, "Error: usage: count LO HI.\n");
+            return;
+        }
+        const char *error = check_followers(loStr, &lo);
+        if (error == NULL) {
+            error = check_followers(hiStr, &hi);
+        }
+        if (error != NULL) {
+            fprintf(stderr, "Error: %s\n", error);
+            return;
+        }
+        printf("%ld records have between %lu and %lu followers.\n", db_count_followers(db, lo, hi), lo, hi);
+    } else if (strcmp(command, "since") == 0) {
+        //"since TIMESTAMP [PATH]" lists or exports the records changed at or after TIMESTAMP
+        char *sinceStr = strtok(NULL, " \n");
+        char *path = strtok(NULL, " \n");
+        unsigned long since;
+        if (sinceStr == NULL || strtok(NULL, " \n") != NULL) {
+            fprintf(stderr, "Error: usage: since TIMESTAMP [PATH].\n");
+            return;
+        }
+        char *endptr;
+        errno = 0;
+        since = strtoul(sinceStr, &endptr, 10);
+        if (sinceStr[0] == '-' || endptr == sinceStr || *endptr != '\0' || errno == ERANGE) {
+            fprintf(stderr, "Error: TIMESTAMP must be a number of seconds since the epoch.\n");
+            return;
+        }
+        if (path == NULL) {
+            OutBuf out;
+            list_begin(&out);
+            db_since(db, &out, since);
+            out_close(&out);
+        } else {
+            int count = db_write_csv_since(db, path, since);
+            if (count >= 0) {
+                printf("Wrote %d records to %s.\n", count, path);
+            }
+        }
+    } else if (strcmp(command, "find") == 0 || strcmp(command, "grep") == 0) {
+        //"find PREFIX" lists the handles starting with PREFIX, "grep SUBSTR" the ones containing SUBSTR
+        char *pattern = strtok(NULL, " \n");
+        if (pattern == NULL || strtok(NULL, " \n") != NULL) {
+            fprintf(stderr, "Error: usage: %s %s.\n", command, strcmp(command, "find") == 0 ? "PREFIX" : "SUBSTR");
+            return;
+        }
+        OutBuf out;
+        list_begin(&out);
+        if (strcmp(command, "find") == 0) {
+            db_find(db, &out, pattern);
+        } else {
+            db_grep(db, &out, pattern);
+        }
+        out_close(&out);
+    } else if (strcmp(command, "search") == 0) {
+        //"search WORD..." lists the records whose comment holds every word
+        char *query = strtok(NULL, "\n");
+        OutBuf out;
+        list_begin(&out);
+        int searched = db_search(db, &out, query != NULL ? query : "");
+        out_close(&out);
+        if (!searched) {
+            fprintf(stderr, "Error: usage: search WORD....\n");
+        }
+    } else if (strcmp(command, "stats") == 0) {
+        //"stats" prints the counters and latency histograms gathered since startup, "stats followers" summarizes the records
+        char *subject = strtok(NULL, " \n");
+        if ((subject != NULL && strcmp(subject, "followers") != 0) || strtok(NULL, " \n") != NULL) {
+            fprintf(stderr, "Error: usage: stats [followers].\n");
+            return;
+        }
+        OutBuf out;
+        list_begin(&out);
+        if (subject != NULL) {
+            db_stats_followers(db, &out);
         } else {
-            db_list(db);
+            stats_print(&out);
+        }
+        out_close(&out);
+    } else if (strcmp(command, "histogram") == 0) {
+        //"histogram BUCKETS" counts the records in BUCKETS equal ranges of followers
+        char *bucketsStr = strtok(NULL, " \n");
+        unsigned long buckets;
+        if (bucketsStr == NULL || strtok(NULL, " \n") != NULL) {
+            fprintf(stderr, "Error: usage: histogram BUCKETS.\n");
+            return;
+        }
+        if (check_followers(bucketsStr, &buckets) != NULL || buckets < 1 || buckets > HISTOGRAM_MAX_BUCKETS) {
+            fprintf(stderr, "Error: BUCKETS must be between 1 and %d.\n", HISTOGRAM_MAX_BUCKETS);
+            return;
+        }
+        OutBuf out;
+        list_begin(&out);
+        db_histogram(db, &out, (int)buckets);
+        out_close(&out);
+    } else if (strcmp(command, "merge") == 0) {
+        //"merge PATH" upserts the rows of another CSV file, keeping whichever side of each handle is newer
+        char *path = strtok(NULL, " \n");
+        if (path == NULL || strtok(NULL, " \n") != NULL) {
+            fprintf(stderr, "Error: usage: merge PATH.\n");
+            return;
+        }
+        if (undoHistory.inTransaction) {
+            fprintf(stderr, "Error: a merge cannot be part of a transaction, commit or rollback first.\n");
+            return;
+        }
+        OutBuf out;
+        list_begin(&out);
+        if (db_merge(db, &out, path, flag)) {
+            undo_clear(&undoHistory); //a merge cannot be undone, and earlier steps would undo over it
+        }
+        out_close(&out);
+    } else if (strcmp(command, "begin") == 0 || strcmp(command, "commit") == 0
+               || strcmp(command, "rollback") == 0 || strcmp(command, "undo") == 0) {
+        //"begin" starts a transaction that "commit" keeps or "rollback" reverts; "undo" reverts the last command or transaction
+        if (strtok(NULL, " \n") != NULL) {
+            fprintf(stderr, "Error: '%s' command does not take any arguments.\n", command);
+            return;
+        }
+        if (strcmp(command, "begin") == 0) {
+            if (undoHistory.inTransaction) {
+                fprintf(stderr, "Error: a transaction is already open.\n");
+                return;
+            }
+            undoHistory.inTransaction = 1;
+            printf("Transaction started.\n");
+        } else if (strcmp(command, "undo") == 0) {
+            if (undoHistory.inTransaction) {
+                fprintf(stderr, "Error: use 'rollback' inside a transaction.\n");
+                return;
+            }
+            int reverted = undo_last(db, &undoHistory, current_time(), record_change, flag);
+            if (reverted < 0) {
+                fprintf(stderr, "Error: nothing to undo.\n");
+                return;
+            }
+            printf("Undid %d changes.\n", reverted);
+        } else if (!undoHistory.inTransaction) {
+            fprintf(stderr, "Error: no transaction is open.\n");
+        } else if (strcmp(command, "commit") == 0) {
+            //nothing was journaled while the transaction ran; it goes in now, one entry per handle it touched
+            undoHistory.inTransaction = 0;
+            int changes = undoHistory.open.count;
+            undo_final_changes(db, &undoHistory.open, record_change, flag);
+            undo_push(&undoHistory);
+            printf("Committed %d changes.\n", changes);
+        } else {
+            undoHistory.inTransaction = 0;
+            printf("Rolled back %d changes.\n", undo_revert(db, &undoHistory.open, 0, NULL, flag));
         }
     } else if (strcmp(command, "save") == 0) {
         //"save" command.
@@ -255,10 +928,36 @@ void process_command(Database *db, char *input, int *should_exit, int *flag) {
             fprintf(stderr, "Error: 'save' command does not take any arguments.\n");
             return;
         }
-        db_save(db);
-        *flag = 0; //flag is 0 since saved 
+        if (undoHistory.inTransaction) {
+            fprintf(stderr, "Error: commit or rollback the open transaction before saving.\n");
+            return;
+        }
+        db_save_background(db, flag); //the flag is cleared once the save finishes
+    } else if (strcmp(command, "export") == 0 || strcmp(command, "snapshot") == 0) {
+        //"export PATH" writes CSV, "snapshot PATH" writes the binary format; neither changes where save goes
+        char *path = strtok(NULL, " \n");
+        if (path == NULL || strtok(NULL, " \n") != NULL) {
+            fprintf(stderr, "Error: usage: %s PATH.\n", command);
+            return;
+        }
+        if (strcmp(command, "export") == 0) {
+            if (!db_write_csv(db, path)) {
+                return;
+            }
+        } else if (!snapshot_write(db, path)) {
+            return;
+        }
+        printf("Wrote %d records to %s.\n", db_live_records(db), path);
     } else if (strcmp(command, "exit") == 0) {
 	 handle_exit_command(db, should_exit, flag);
+    } else if (strcmp(command, "delete") == 0) {
+        //"delete HANDLE" removes the record
+        char *handle = strtok(NULL, " \n");
+        if (handle == NULL || strtok(NULL, " \n") != NULL) {
+            fprintf(stderr, "Error: usage: delete HANDLE.\n");
+            return;
+        }
+        db_delete(db, handle, flag);
     } else if (strcmp(command, "add") == 0 || strcmp(command, "update") == 0) {
         // Proceed only if command is "add" or "update".
         char *handle = strtok(NULL, " \n"); //get the handle
@@ -306,14 +1005,13 @@ void process_command(Database *db, char *input, int *should_exit, int *flag) {
 
 
 //main loop
-int main_loop(Database *db) {
+int main_loop(Database *db, int flag) {
     char *input = NULL; // Buffer for input, getline will allocate memory
     size_t input_size = 0; // Size of the input buffer
     int should_exit = 0; //track when should exit the program
-    int flag = 0; //track when modified
 
 
-    printf("Loaded %d records.\n", db->size); // Prints how many records in database
+    printf("Loaded %d records.\n", db_live_records(db)); // Prints how many records in database
 
     while (!should_exit) { // Loop to keep going until exit
         print_prompt();
@@ -321,18 +1019,328 @@ int main_loop(Database *db) {
         ssize_t characters_read = getline(&input, &input_size, stdin);
         if (characters_read == -1) { // Check for read error or EOF and entire program terminates since while loop is broken
             printf("Error reading input or EOF encountered.\n");
+            save_poll(1); //let a background save finish
 	    db_free(db); //makes sure memory is freed anyways
             break;
         }
         process_command(db, input, &should_exit, &flag); // Call to process command
+        save_poll(0); //report a background save that has finished
+        if (!should_exit) {
+            db_compact_step(db); //a running compaction advances a little after every command
+        }
     }
     free(input); // Free the allocated buffer
+    journal_close(&journal);
     return 0; // Returns 0 upon successful execution
 }
+/*
+ * returns a monotonic timestamp in seconds
+ */
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* validates one batch line of the form "add|update HANDLE FOLLOWERS COMMENT..." or "delete HANDLE"
+ * @param line the line without its newline, modified in place
+ * @param *op filled in if the line is valid
+ * @return NULL on success, otherwise the reason the line was rejected
+ */
+const char *parse_batch_line(char *line, BatchOp *op) {
+    char *save;
+    char *command = strtok_r(line, " \t", &save);
+    char *handle = strtok_r(NULL, " \t", &save);
+
+    if (command != NULL && strcmp(command, "delete") == 0) {
+        if (handle == NULL || strtok_r(NULL, " \t", &save) != NULL) {
+            return "usage: delete HANDLE";
+        }
+        if (strlen(handle) >= sizeof(op->record.handle)) {
+            return "Handle is too long.";
+        }
+        op->kind = JOURNAL_DELETE;
+        strcpy(op->record.handle, handle);
+        return NULL;
+    }
+
+    char *followers = strtok_r(NULL, " \t", &save);
+    char *comment = strtok_r(NULL, "", &save); //the rest of the line, spaces included
+
+    if (command == NULL || handle == NULL || followers == NULL || comment == NULL) {
+        return "usage: add|update HANDLE FOLLOWERS COMMENT";
+    }
+    if (strcmp(command, "add") == 0) {
+        op->kind = JOURNAL_ADD;
+    } else if (strcmp(command, "update") == 0) {
+        op->kind = JOURNAL_UPDATE;
+    } else {
+        return "Unrecognized command.";
+    }
+
+    const char *error = check_handle(handle);
+    if (error == NULL) {
+        error = check_followers(followers, &op->record.followerCount);
+    }
+    if (error == NULL) {
+        while (*comment == ' ' || *comment == '\t') {
+            comment++;
+        }
+        error = check_comment(comment);
+    }
+    if (error != NULL) {
+        return error;
+    }
+
+    strcpy(op->record.handle, handle);
+    //long comments are cut to the field size, as they are at the Comment> prompt
+    strncpy(op->comment, comment, sizeof(op->comment) - 1);
+    op->comment[sizeof(op->comment) - 1] = '\0';
+    return NULL;
+}
+
+/*
+ * runs every line of a batch file against the database and saves once at the end
+ * lines are validated first, then applied in order, then the database is written
+ * @param path the batch file, or "-" for standard input
+ * @return 0 if every line was applied, 1 otherwise
+ */
+int run_batch(Database *db, const char *path) {
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rt");
+    if (file == NULL) {
+        fprintf(stderr, "Error: unable to open batch file '%s'.\n", path);
+        return 1;
+    }
+
+    BatchOp *ops = NULL;
+    long count = 0;
+    long capacity = 0;
+    long lineNumber = 0;
+    long rejected = 0;
+    long adds = 0;
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t nread;
+
+    //validation pass
+    double start = now_seconds();
+    while ((nread = getline(&line, &len, file)) != -1) {
+        lineNumber++;
+        if (nread > 0 && line[nread - 1] == '\n') {
+            line[--nread] = '\0';
+        }
+        if (line[strspn(line, " \t")] == '\0' || line[0] == '#') {
+            continue; //blank lines and comments
+        }
+
+        if (count == capacity) {
+            capacity = capacity == 0 ? 1024 : capacity*2;
+            ops = realloc(ops, capacity * sizeof(BatchOp));
+            if (ops == NULL) {
+                fprintf(stderr, "Failed memory allocation.\n");
+                exit(1);
+            }
+        }
+        BatchOp *op = &ops[count];
+        memset(op, 0, sizeof(*op));
+        op->line = lineNumber;
+
+        const char *error = parse_batch_line(line, op);
+        if (error != NULL) {
+            fprintf(stderr, "Error: line %ld: %s\n", lineNumber, error);
+            rejected++;
+            continue;
+        }
+        adds += op->kind == JOURNAL_ADD;
+        count++;
+    }
+    free(line);
+    if (file != stdin) {
+        fclose(file);
+    }
+    double validateTime = now_seconds() - start;
+
+    //apply pass, with the records array and index sized once up front
+    start = now_seconds();
+    db_reserve(db, (int)adds);
+    unsigned long now = current_time();
+    long added = 0;
+    long updated = 0;
+    long deleted = 0;
+    for (long i = 0; i < count; i++) {
+        BatchOp *op = &ops[i];
+        Record *rec = db_lookup(db, op->record.handle);
+
+        if (op->kind == JOURNAL_DELETE) {
+            if (rec == NULL) {
+                fprintf(stderr, "Error: line %ld: no entry with handle %s\n", op->line, op->record.handle);
+                rejected++;
+                continue;
+            }
+            db_remove(db, op->record.handle);
+            deleted++;
+        } else if (op->kind == JOURNAL_ADD) {
+            if (rec != NULL) {
+                fprintf(stderr, "Error: line %ld: Handle '%s' already exists.\n", op->line, op->record.handle);
+                rejected++;
+                continue;
+            }
+            op->record.comment = op->comment;
+            op->record.dateLastModified = now;
+            db_append(db, &op->record);
+            added++;
+        } else {
+            if (rec == NULL) {
+                fprintf(stderr, "Error: line %ld: no entry with handle %s\n", op->line, op->record.handle);
+                rejected++;
+                continue;
+            }
+            db_update_record(db, rec, op->record.followerCount, op->comment, now);
+            updated++;
+        }
+    }
+    free(ops);
+    double applyTime = now_seconds() - start;
+
+    //save pass
+    start = now_seconds();
+    int saved = added + updated + deleted == 0 || db_save(db);
+    double saveTime = now_seconds() - start;
+
+    double total = validateTime + applyTime + saveTime;
+    printf("Batch: %ld lines, %ld added, %ld updated, %ld deleted, %ld rejected\n", lineNumber, added, updated, deleted, rejected);
+    printf("Batch: validate %.3f s, apply %.3f s, save %.3f s, %.0f records/sec\n",
+           validateTime, applyTime, saveTime, total > 0 ? (added + updated + deleted) / total : 0.0);
+
+    return rejected == 0 && saved ? 0 : 1;
+}
+
+/*
+ * prints command line usage
+ */
+void print_usage(char const *program){
+    fprintf(stderr, "usage: %s [-j THREADS] [-J] [-c] [-z] [--batch BATCH | --server SOCKET] [--stats-json PATH] [FILE]\n", program);
+    fprintf(stderr, "  FILE        CSV file or snapshot to load and save (default: database.csv)\n");
+    fprintf(stderr, "  -j THREADS  number of threads used to load a CSV file (default: one per CPU)\n");
+    fprintf(stderr, "  -c, --columnar  also keep followers and dates in separate arrays for faster scans\n");
+    fprintf(stderr, "  -z, --compress  save FILE block compressed; compressed files are recognized on load and stay compressed\n");
+    fprintf(stderr, "  -J          journal every change to FILE.journal so it survives without a save\n");
+    fprintf(stderr, "  -b, --batch BATCH  apply \"add|update HANDLE FOLLOWERS COMMENT\" and \"delete HANDLE\" lines from BATCH (- for stdin), save and exit\n");
+    fprintf(stderr, "  -S, --server SOCKET  serve commands to any number of clients on a Unix socket until SIGINT or SIGTERM\n");
+    fprintf(stderr, "  --stats-json PATH  write the counters and histograms shown by 'stats' to PATH as JSON on exit\n");
+}
+
 //main 
-int main()
+int main(int argc, char **argv)
 {
+    long threads = sysconf(_SC_NPROCESSORS_ONLN); //load on every CPU unless told otherwise
+    const char *batchPath = NULL;
+    const char *socketPath = NULL;
+    const char *statsPath = NULL;
+    int columnar = 0;
+    int opt;
+    static struct option longOptions[] = {
+        { "threads", required_argument, NULL, 'j' },
+        { "journal", no_argument, NULL, 'J' },
+        { "batch", required_argument, NULL, 'b' },
+        { "columnar", no_argument, NULL, 'c' },
+        { "compress", no_argument, NULL, 'z' },
+        { "server", required_argument, NULL, 'S' },
+        { "stats-json", required_argument, NULL, 's' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    while ((opt = getopt_long(argc, argv, "j:Jb:czS:", longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'j': {
+            char *endptr;
+            threads = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || threads < 1 || threads > 1024) {
+                fprintf(stderr, "Error: thread count must be between 1 and 1024.\n");
+                return 1;
+            }
+            break;
+        }
+        case 'J':
+            journalEnabled = 1;
+            break;
+        case 'b':
+            batchPath = optarg;
+            break;
+        case 'c':
+            columnar = 1;
+            break;
+        case 'z':
+            dbIsCompressed = 1;
+            break;
+        case 'S':
+            socketPath = optarg;
+            break;
+        case 's':
+            statsPath = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc) {
+        dbPath = argv[optind++];
+    }
+    if (optind != argc || (batchPath != NULL && socketPath != NULL)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    loadThreads = (int)threads;
+
     Database db = db_create();
-    db_load_csv(&db, "database.csv");
-    return main_loop(&db);
+    if (snapshot_detect(dbPath)) { //snapshots are mapped and used as is, CSV files are parsed
+        if (!snapshot_load(&db, dbPath)) {
+            db_free(&db);
+            return 1;
+        }
+        dbIsSnapshot = 1;
+    } else {
+        int fd = open(dbPath, O_RDONLY);
+        if (fd != -1) { //a compressed file is saved compressed again
+            dbIsCompressed |= codec_detect(fd);
+            close(fd);
+        }
+        db_load_csv_parallel(&db, dbPath, (int)threads);
+    }
+
+    if (columnar) {
+        db_enable_columns(&db);
+    }
+
+    //changes journaled by an earlier session that never saved
+    long replayed = journal_replay(&db, dbPath);
+    if (replayed > 0) {
+        printf("Replayed %ld journal entries.\n", replayed);
+    }
+    if (journalEnabled && !journal_open(&journal, dbPath)) {
+        db_free(&db);
+        return 1;
+    }
+    int status;
+    if (batchPath != NULL) {
+        status = run_batch(&db, batchPath);
+        journal_close(&journal);
+        db_free(&db);
+    } else if (socketPath != NULL) {
+        //without a journal to keep them, replayed changes count as unsaved
+        status = server_run(&db, socketPath, replayed > 0 && !journalEnabled);
+        journal_close(&journal);
+        db_free(&db);
+    } else {
+        status = main_loop(&db, replayed > 0 && !journalEnabled);
+    }
+
+    if (statsPath != NULL && !stats_write_json(statsPath)) {
+        status = 1;
+    }
+    return status;
 }
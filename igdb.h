@@ -0,0 +1,66 @@
+#ifndef IGDB_H
+#define IGDB_H
+
+#include <time.h>
+#include "database.h"
+#include "output.h"
+#include "journal.h"
+
+/*
+ * commands shared by the interactive loop, batch mode and the server
+ */
+
+//largest BUCKETS accepted by the histogram command
+#define HISTOGRAM_MAX_BUCKETS 1000
+
+/*
+ * one validated line of a batch file
+ */
+typedef struct BatchOp {
+    char kind; //JOURNAL_ADD, JOURNAL_UPDATE or JOURNAL_DELETE
+    long line; //line number in the batch file, for error messages
+    Record record; //handle and followers, only the handle for a delete; the comment and date are filled in when it is applied
+    char comment[COMMENT_SIZE];
+} BatchOp;
+
+time_t current_time();
+
+void db_list(Database * db, OutBuf * out, unsigned long offset, unsigned long limit);
+
+void db_top(Database * db, OutBuf * out, unsigned long n);
+
+void db_range(Database * db, OutBuf * out, unsigned long lo, unsigned long hi);
+
+void db_since(Database * db, OutBuf * out, unsigned long since);
+
+void db_find(Database * db, OutBuf * out, char const * prefix);
+
+void db_grep(Database * db, OutBuf * out, char const * substring);
+
+int db_search(Database * db, OutBuf * out, char const * query);
+
+void db_stats_followers(Database * db, OutBuf * out);
+
+void db_histogram(Database * db, OutBuf * out, int buckets);
+
+int db_merge(Database * db, OutBuf * out, char const * path, int * flag);
+
+const char *check_followers(const char * str, unsigned long * value);
+
+const char *check_handle(const char * handle);
+
+const char *check_comment(const char * comment);
+
+const char *parse_batch_line(char * line, BatchOp * op);
+
+void record_change(Database * db, char op, Record const * record, int * flag);
+
+int db_save(Database * db);
+
+int db_save_background(Database * db, int * flag);
+
+void save_poll(int block);
+
+double now_seconds();
+
+#endif
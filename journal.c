@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "journal.h"
+
+//the longest entry: the operation, a full handle, two 20 digit numbers, a full comment, four commas and the newline
+#define JOURNAL_LINE_SIZE (1 + sizeof(((Record *)0)->handle) + 2 * 20 + COMMENT_SIZE + 4 + 1)
+
+/*
+ * @param *dbPath path of the database file
+ * @return newly allocated path of the journal that belongs to it
+ */
+char *journal_path(char const *dbPath){
+	char *path = malloc(strlen(dbPath) + sizeof(".journal"));
+	if(path == NULL){
+		fprintf(stderr, "Failed memory allocation.\n");
+		exit(1);
+	}
+	sprintf(path, "%s.journal", dbPath);
+	return path;
+}
+
+/*
+ * applies one journal entry to the database
+ * entries are idempotent, so replaying a journal over a file that already contains its changes is harmless
+ * @return 1 if the entry was well formed, 0 otherwise
+ */
+static int apply_entry(Database *db, char const *line, char const *end){
+	Record record;
+	char const *comment;
+	size_t commentLength;
+
+	if(end - line < 2 || line[1] != ','){
+		return 0;
+	}
+	parse_line(line + 2, end, &record, &comment, &commentLength);
+	record.comment = arena_intern(&db->strings, comment, commentLength);
+
+	if(line[0] == JOURNAL_ADD){
+		if(db_lookup(db, record.handle) == NULL){
+			db_append(db, &record);
+		}
+		return 1;
+	}
+	if(line[0] == JOURNAL_UPDATE){
+		Record *rec = db_lookup(db, record.handle);
+		if(rec != NULL){
+			db_update_record(db, rec, record.followerCount, record.comment, record.dateLastModified);
+		}
+		return 1;
+	}
+	if(line[0] == JOURNAL_DELETE){
+		db_remove(db, record.handle);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * applies the journal of the database at 'dbPath', if there is one
+ * a last line without a newline is a write that was cut short by a crash and is ignored
+ * @return number of entries applied
+ */
+long journal_replay(Database *db, char const *dbPath){
+	char *path = journal_path(dbPath);
+	FILE *file = fopen(path, "rt");
+	long applied = 0;
+
+	free(path);
+	if(file == NULL){
+		return 0;
+	}
+
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t nread;
+	while((nread = getline(&line, &len, file)) != -1){
+		if(line[nread - 1] != '\n'){
+			break; //torn write
+		}
+		if(apply_entry(db, line, line + nread - 1)){
+			applied++;
+		}else{
+			fprintf(stderr, "Warning: skipping malformed journal entry.\n");
+		}
+	}
+
+	free(line);
+	fclose(file);
+	return applied;
+}
+
+/*
+ * opens the journal of the database at 'dbPath' for appending, creating it if needed
+ * a torn entry at the end of the file is cut off so new entries start on a fresh line
+ * @return 1 on success, 0 on failure
+ */
+int journal_open(Journal *journal, char const *dbPath){
+	journal->path = journal_path(dbPath);
+	journal->entries = 0;
+	journal->fd = open(journal->path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if(journal->fd == -1){
+		fprintf(stderr, "Error: unable to open journal '%s'.\n", journal->path);
+		free(journal->path);
+		journal->path = NULL;
+		return 0;
+	}
+
+	//count complete entries and find where the last one ends
+	char buffer[65536];
+	off_t offset = 0;
+	off_t lastNewline = 0;
+	ssize_t nread;
+	while((nread = pread(journal->fd, buffer, sizeof(buffer), offset)) > 0){
+		for(ssize_t i = 0; i < nread; i++){
+			if(buffer[i] == '\n'){
+				journal->entries++;
+				lastNewline = offset + i + 1;
+			}
+		}
+		offset += nread;
+	}
+	if(lastNewline != offset && ftruncate(journal->fd, lastNewline) != 0){
+		fprintf(stderr, "Warning: unable to trim torn journal entry.\n");
+	}
+	return 1;
+}
+
+/*
+ * appends one entry and waits until it is on disk
+ * @param op JOURNAL_ADD, JOURNAL_UPDATE or JOURNAL_DELETE
+ * @param *record the record as it is after the change, or as it was before a delete
+ * @return 1 if the entry is durable, 0 otherwise
+ */
+int journal_append(Journal *journal, char op, Record const *record){
+	char line[JOURNAL_LINE_SIZE];
+
+	if(journal->fd == -1){
+		return 0;
+	}
+
+	//a single write keeps the entry contiguous even if the process dies halfway
+	int length = snprintf(line, sizeof(line), "%c,%s,%lu,%s,%lu\n",
+	                      op, record->handle, record->followerCount, record->comment, record->dateLastModified);
+	if(length < 0 || length >= (int)sizeof(line)){
+		fprintf(stderr, "Error: journal entry for '%s' is too long.\n", record->handle);
+		return 0;
+	}
+	if(write(journal->fd, line, length) != length || fdatasync(journal->fd) != 0){
+		fprintf(stderr, "Error: failed to write journal entry.\n");
+		return 0;
+	}
+	journal->entries++;
+	return 1;
+}
+
+/*
+ * empties the journal once its changes are part of the database file
+ * @return 1 on success, 0 on failure
+ */
+int journal_reset(Journal *journal){
+	if(journal->fd == -1){
+		return 0;
+	}
+	if(ftruncate(journal->fd, 0) != 0 || fsync(journal->fd) != 0){
+		fprintf(stderr, "Error: failed to truncate journal '%s'.\n", journal->path);
+		return 0;
+	}
+	journal->entries = 0;
+	return 1;
+}
+
+/*
+ * @return the length of the journal file in bytes, the point entries appended from now on start at
+ */
+off_t journal_size(Journal *journal){
+	if(journal->fd == -1){
+		return 0;
+	}
+	return lseek(journal->fd, 0, SEEK_END);
+}
+
+/*
+ * drops the entries before byte 'offset', which are now part of the database file, and keeps those after it
+ * the kept tail goes to a new file that is renamed over the journal, so a crash leaves either the old or the new one
+ * @param long entries number of entries before offset
+ * @return 1 on success, 0 on failure
+ */
+int journal_trim(Journal *journal, off_t offset, long entries){
+	off_t end = journal_size(journal);
+
+	if(journal->fd == -1){
+		return 0;
+	}
+	if(offset >= end){
+		return journal_reset(journal);
+	}
+
+	char *tmpPath = malloc(strlen(journal->path) + sizeof(".tmp"));
+	char *tail = malloc(end - offset);
+	if(tmpPath == NULL || tail == NULL){
+		fprintf(stderr, "Failed memory allocation.\n");
+		exit(1);
+	}
+	sprintf(tmpPath, "%s.tmp", journal->path);
+
+	int ok = pread(journal->fd, tail, end - offset, offset) == end - offset;
+	int fd = ok ? open(tmpPath, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644) : -1;
+	ok = fd != -1 && write(fd, tail, end - offset) == end - offset && fsync(fd) == 0 && rename(tmpPath, journal->path) == 0;
+	free(tail);
+	free(tmpPath);
+	if(!ok){
+		if(fd != -1){
+			close(fd);
+		}
+		fprintf(stderr, "Error: failed to trim journal '%s'.\n", journal->path);
+		return 0;
+	}
+
+	//keep appending to the new file, which now has the journal's name
+	close(journal->fd);
+	journal->fd = fd;
+	journal->entries -= entries;
+	return 1;
+}
+
+/*
+ * closes the journal, leaving the file in place so it is replayed next time
+ */
+void journal_close(Journal *journal){
+	if(journal->fd != -1){
+		close(journal->fd);
+		journal->fd = -1;
+	}
+	free(journal->path);
+	journal->path = NULL;
+}
@@ -0,0 +1,38 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <sys/types.h>
+#include "database.h"
+
+//operations recorded in the journal
+#define JOURNAL_ADD 'A'
+#define JOURNAL_UPDATE 'U'
+#define JOURNAL_DELETE 'D'
+
+/*
+ * append-only log of changes made since the database file was last written
+ * each entry is one line: the operation, a comma and the full record in CSV format
+ */
+typedef struct Journal {
+ int fd; //open for appending, -1 if the journal is closed
+ char *path; //database path with ".journal" appended
+ long entries; //number of entries in the file
+} Journal;
+
+int journal_open(Journal * journal, char const * dbPath);
+
+int journal_append(Journal * journal, char op, Record const * record);
+
+int journal_reset(Journal * journal);
+
+off_t journal_size(Journal * journal);
+
+int journal_trim(Journal * journal, off_t offset, long entries);
+
+void journal_close(Journal * journal);
+
+long journal_replay(Database * db, char const * dbPath);
+
+char *journal_path(char const * dbPath);
+
+#endif
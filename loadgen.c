@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * load generator for igdb --server
+ * each client thread holds one connection and sends a mix of get and update commands back to back
+ */
+
+typedef struct LoadClient {
+ char const *socketPath;
+ long ops; //commands to send
+ int writePercent; //share of the commands that are updates
+ long keys; //handles @load0 .. @load<keys - 1> to pick from
+ unsigned int seed;
+ double *latencies; //seconds taken by each command
+ long errors;
+} LoadClient;
+
+/*
+ * returns a monotonic timestamp in seconds
+ */
+double now_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * @return a connected socket, or -1
+ */
+int connect_server(char const *socketPath){
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(fd == -1){
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * sends one command and reads the reply up to its OK or ERR line
+ * @return 1 for OK, 0 for ERR, -1 if the connection failed
+ */
+int send_command(int fd, FILE *in, char const *command, char **line, size_t *len){
+    size_t length = strlen(command);
+    char const *p = command;
+
+    while(length > 0){
+        ssize_t written = write(fd, p, length);
+        if(written <= 0){
+            return -1;
+        }
+        p += written;
+        length -= written;
+    }
+    while(getline(line, len, in) != -1){
+        if(strcmp(*line, "OK\n") == 0){
+            return 1;
+        }
+        if(strncmp(*line, "ERR", 3) == 0){
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * client thread: sends 'ops' commands and records how long each one took
+ */
+void *run_client(void *arg){
+    LoadClient *client = arg;
+    char command[128];
+    char *line = NULL;
+    size_t len = 0;
+
+    int fd = connect_server(client->socketPath);
+    FILE *in = fd != -1 ? fdopen(fd, "r") : NULL;
+    if(in == NULL){
+        fprintf(stderr, "Error: unable to connect to '%s'.\n", client->socketPath);
+        client->errors = client->ops;
+        return NULL;
+    }
+
+    for(long i = 0; i < client->ops; i++){
+        long key = rand_r(&client->seed) % client->keys;
+        if((int)(rand_r(&client->seed) % 100) < client->writePercent){
+            snprintf(command, sizeof(command), "update @load%ld %d load generator %ld\n", key, rand_r(&client->seed) % 100000, i);
+        }else{
+            snprintf(command, sizeof(command), "get @load%ld\n", key);
+        }
+
+        double start = now_seconds();
+        int status = send_command(fd, in, command, &line, &len);
+        client->latencies[i] = now_seconds() - start;
+        if(status == -1){
+            client->errors += client->ops - i;
+            break;
+        }
+        client->errors += status == 0;
+    }
+
+    send_command(fd, in, "quit\n", &line, &len);
+    free(line);
+    fclose(in);
+    return NULL;
+}
+
+int compare_doubles(void const *a, void const *b){
+    double x = *(double const *)a;
+    double y = *(double const *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * adds the handles the clients pick from; handles left by an earlier run are kept
+ * @return 1 on success, 0 if the server could not be reached
+ */
+int create_keys(char const *socketPath, long keys){
+    char command[128];
+    char *line = NULL;
+    size_t len = 0;
+
+    int fd = connect_server(socketPath);
+    FILE *in = fd != -1 ? fdopen(fd, "r") : NULL;
+    if(in == NULL){
+        fprintf(stderr, "Error: unable to connect to '%s'.\n", socketPath);
+        return 0;
+    }
+    for(long i = 0; i < keys; i++){
+        snprintf(command, sizeof(command), "add @load%ld %ld load generator\n", i, i);
+        if(send_command(fd, in, command, &line, &len) == -1){
+            fprintf(stderr, "Error: connection to '%s' lost.\n", socketPath);
+            fclose(in);
+            free(line);
+            return 0;
+        }
+    }
+    send_command(fd, in, "quit\n", &line, &len);
+    free(line);
+    fclose(in);
+    return 1;
+}
+
+/*
+ * runs one round with 'count' clients and prints throughput and latency percentiles
+ */
+void run_round(char const *socketPath, int count, long ops, int writePercent, long keys){
+    LoadClient *clients = calloc(count, sizeof(LoadClient));
+    pthread_t *threads = calloc(count, sizeof(pthread_t));
+    double *latencies = malloc(count * ops * sizeof(double));
+    if(clients == NULL || threads == NULL || latencies == NULL){
+        fprintf(stderr, "Failed memory allocation.\n");
+        exit(1);
+    }
+
+    double start = now_seconds();
+    for(int i = 0; i < count; i++){
+        clients[i].socketPath = socketPath;
+        clients[i].ops = ops;
+        clients[i].writePercent = writePercent;
+        clients[i].keys = keys;
+        clients[i].seed = 12345 + i;
+        clients[i].latencies = latencies + i * ops;
+        memset(clients[i].latencies, 0, ops * sizeof(double));
+        if(pthread_create(&threads[i], NULL, run_client, &clients[i]) != 0){
+            fprintf(stderr, "Error: unable to start client thread.\n");
+            exit(1);
+        }
+    }
+    long errors = 0;
+    for(int i = 0; i < count; i++){
+        pthread_join(threads[i], NULL);
+        errors += clients[i].errors;
+    }
+    double elapsed = now_seconds() - start;
+
+    long total = count * ops;
+    qsort(latencies, total, sizeof(double), compare_doubles);
+    printf("%4d clients | %8ld ops | %10.0f ops/sec | p50 %8.1f us | p99 %8.1f us | max %8.1f us | %ld errors\n",
+           count, total, total / elapsed, latencies[total / 2] * 1e6, latencies[total * 99 / 100] * 1e6,
+           latencies[total - 1] * 1e6, errors);
+
+    free(clients);
+    free(threads);
+    free(latencies);
+}
+
+void print_usage(char const *program){
+    fprintf(stderr, "usage: %s [-s SOCKET] [-n OPS] [-w WRITE_PERCENT] [-k KEYS] [CLIENTS...]\n", program);
+    fprintf(stderr, "  -s SOCKET         socket of igdb --server (default: igdb.sock)\n");
+    fprintf(stderr, "  -n OPS            commands per client per round (default: 10000)\n");
+    fprintf(stderr, "  -w WRITE_PERCENT  share of updates, the rest are gets (default: 10)\n");
+    fprintf(stderr, "  -k KEYS           handles to spread the commands over (default: 10000)\n");
+    fprintf(stderr, "  CLIENTS           client counts to run a round with (default: 1 2 4 8 16)\n");
+}
+
+int main(int argc, char **argv){
+    char const *socketPath = "igdb.sock";
+    long ops = 10000;
+    int writePercent = 10;
+    long keys = 10000;
+    int opt;
+
+    while((opt = getopt(argc, argv, "s:n:w:k:")) != -1){
+        switch(opt){
+        case 's':
+            socketPath = optarg;
+            break;
+        case 'n':
+            ops = atol(optarg);
+            break;
+        case 'w':
+            writePercent = atoi(optarg);
+            break;
+        case 'k':
+            keys = atol(optarg);
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if(ops < 1 || keys < 1 || writePercent < 0 || writePercent > 100){
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if(!create_keys(socketPath, keys)){
+        return 1;
+    }
+    if(optind == argc){
+        int counts[] = {1, 2, 4, 8, 16};
+        for(int i = 0; i < 5; i++){
+            run_round(socketPath, counts[i], ops, writePercent, keys);
+        }
+    }else{
+        for(int i = optind; i < argc; i++){
+            int count = atoi(argv[i]);
+            if(count > 0){
+                run_round(socketPath, count, ops, writePercent, keys);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "merge.h"
+
+//rows ahead of the current one whose index slot and records are prefetched during the probe
+#define MERGE_PREFETCH 16
+
+//target of a row that loses to another row or to the database
+#define MERGE_SKIP -2
+//target of a row whose handle is not in the database
+#define MERGE_INSERT -1
+
+/*
+ * one incoming row, keyed so that sorting by key orders rows by their home slot in the database's index
+ */
+typedef struct MergeKey {
+	unsigned int key; //hash rotated so the bits that pick the index slot come first
+	int id; //row number in the incoming table
+} MergeKey;
+
+/*
+ * @return 'hash' rotated right by 'bits', so its low 'bits' bits become the most significant ones
+ */
+static unsigned int slot_order(unsigned int hash, int bits){
+	return bits == 0 || bits == 32 ? hash : hash >> bits | hash << (32 - bits);
+}
+
+/*
+ * least significant digit radix sort on key, 16 bits per pass
+ * rows with equal hashes end up next to each other, which is what drop_duplicates relies on
+ */
+static void sort_keys(MergeKey **keys, MergeKey **spare, int n){
+	int *counts = malloc((1 << 16) * sizeof(int));
+	if(counts == NULL){
+		fprintf(stderr, "Failed memory allocation.\n");
+		exit(1);
+	}
+	for(int shift = 0; shift < 32; shift += 16){
+		memset(counts, 0, (1 << 16) * sizeof(int));
+		for(int i = 0; i < n; i++){
+			counts[(*keys)[i].key >> shift & 0xffff]++;
+		}
+		int total = 0;
+		for(int d = 0; d < (1 << 16); d++){
+			int count = counts[d];
+			counts[d] = total;
+			total += count;
+		}
+		for(int i = 0; i < n; i++){
+			(*spare)[counts[(*keys)[i].key >> shift & 0xffff]++] = (*keys)[i];
+		}
+		MergeKey *swap = *keys;
+		*keys = *spare;
+		*spare = swap;
+	}
+	free(counts);
+}
+
+/*
+ * within each run of rows with the same hash, keeps the newest row of every handle; a tie goes to the earlier row
+ */
+static void drop_duplicates(Database const *incoming, MergeKey const *keys, int n, int *target, MergeResult *result){
+	for(int start = 0, end; start < n; start = end){
+		for(end = start + 1; end < n && keys[end].key == keys[start].key; end++){
+		}
+		for(int i = start + 1; i < end; i++){ //runs are almost always a single row
+			Record const *row = &incoming->records[keys[i].id];
+			for(int j = start; j < i; j++){
+				if(target[keys[j].id] == MERGE_SKIP){
+					continue;
+				}
+				Record const *other = &incoming->records[keys[j].id];
+				if(strcmp(row->handle, other->handle) != 0){
+					continue;
+				}
+				int rowWins = row->dateLastModified > other->dateLastModified
+				              || (row->dateLastModified == other->dateLastModified && keys[i].id < keys[j].id);
+				target[rowWins ? keys[j].id : keys[i].id] = MERGE_SKIP;
+				result->kept++;
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * @return the record number of 'handle' in the database, or -1 if it is not there
+ */
+static int probe(Database const *db, char const *handle, unsigned int hash){
+	unsigned int mask = db->indexCapacity - 1;
+	for(unsigned int slot = hash & mask; db->index[slot].record != -1; slot = (slot + 1) & mask){
+		if(db->index[slot].hash == hash && strcmp(db->records[db->index[slot].record].handle, handle) == 0){
+			return db->index[slot].record;
+		}
+	}
+	return -1;
+}
+
+/*
+ * upserts every row of 'incoming' into 'db': a handle that is not in the database is appended, one that is replaces
+ * the record only if its dateLastModified is strictly newer; of several rows with one handle the newest counts
+ * rows are sorted by the index slot their handle hashes to and the index is probed in that order, so the probe walks
+ * the index front to back instead of jumping around it; new rows are appended in file order
+ */
+void merge_database(Database *db, Database *incoming, MergeResult *result){
+	int n = incoming->size;
+	int bits = __builtin_ctz(db->indexCapacity);
+	MergeKey *keys = malloc((n + 1) * sizeof(MergeKey));
+	MergeKey *spare = malloc((n + 1) * sizeof(MergeKey));
+	unsigned int *hashes = malloc((n + 1) * sizeof(unsigned int));
+	int *target = malloc((n + 1) * sizeof(int));
+	if(keys == NULL || spare == NULL || hashes == NULL || target == NULL){
+		fprintf(stderr, "Failed memory allocation.\n");
+		exit(1);
+	}
+
+	memset(result, 0, sizeof(*result));
+	result->rows = n;
+	for(int i = 0; i < n; i++){
+		hashes[i] = db_hash(incoming->records[i].handle);
+		keys[i].key = slot_order(hashes[i], bits);
+		keys[i].id = i;
+		target[i] = MERGE_INSERT;
+	}
+	sort_keys(&keys, &spare, n);
+	free(spare);
+	drop_duplicates(incoming, keys, n, target, result);
+
+	//probe in slot order; the index slot and incoming row come in MERGE_PREFETCH rows ahead,
+	//the matching record half as far ahead once its slot is in cache
+	unsigned int mask = db->indexCapacity - 1;
+	for(int i = 0; i < n; i++){
+		if(i + MERGE_PREFETCH < n){
+			__builtin_prefetch(&db->index[hashes[keys[i + MERGE_PREFETCH].id] & mask]);
+			__builtin_prefetch(&incoming->records[keys[i + MERGE_PREFETCH].id]);
+		}
+		if(i + MERGE_PREFETCH / 2 < n){
+			int home = db->index[hashes[keys[i + MERGE_PREFETCH / 2].id] & mask].record;
+			if(home != -1){
+				__builtin_prefetch(&db->records[home]);
+			}
+		}
+		int id = keys[i].id;
+		if(target[id] != MERGE_SKIP){
+			target[id] = probe(db, incoming->records[id].handle, hashes[id]);
+		}
+	}
+	free(keys);
+	free(hashes);
+
+	long inserts = 0;
+	long updates = 0;
+	for(int id = 0; id < n; id++){
+		if(target[id] == MERGE_INSERT){
+			inserts++;
+		}else if(target[id] >= 0){
+			if(incoming->records[id].dateLastModified > db->records[target[id]].dateLastModified){
+				updates++;
+			}else{
+				target[id] = MERGE_SKIP;
+				result->kept++;
+			}
+		}
+	}
+
+	//rebuilding the lazy indexes on next use beats keeping them up to date through a large share of the table
+	if((inserts + updates) * MERGE_REBUILD_RATIO > db_live_records(db)){
+		db_drop_indexes(db);
+	}
+	for(int id = 0; id < n; id++){
+		if(target[id] >= 0){
+			Record const *row = &incoming->records[id];
+			db_update_record(db, &db->records[target[id]], row->followerCount, row->comment, row->dateLastModified);
+		}
+	}
+	db_reserve(db, (int)inserts);
+	for(int id = 0; id < n; id++){
+		if(target[id] == MERGE_INSERT){
+			db_append(db, &incoming->records[id]);
+		}
+	}
+	result->added = inserts;
+	result->updated = updates;
+	free(target);
+}
+
+/*
+ * loads the CSV file at 'path' with the same loader as the database file and merges it into 'db'
+ * @param int threads threads to parse the file on, as for db_load_csv_parallel
+ * @return 1 on success, 0 if the file cannot be read
+ */
+int merge_csv(Database *db, char const *path, int threads, MergeResult *result){
+	if(access(path, R_OK) != 0){
+		fprintf(stderr, "Error: unable to read '%s'.\n", path);
+		return 0;
+	}
+	Database incoming = db_create();
+	db_load_csv_parallel(&incoming, path, threads);
+	merge_database(db, &incoming, result);
+	db_free(&incoming);
+	return 1;
+}
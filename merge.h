@@ -0,0 +1,23 @@
+#ifndef MERGE_H
+#define MERGE_H
+
+#include "database.h"
+
+//a merge that changes more than this fraction of the table drops the lazy indexes instead of updating them row by row
+#define MERGE_REBUILD_RATIO 8
+
+/*
+ * what a merge did with the rows it read
+ */
+typedef struct MergeResult {
+ long rows; //rows read from the file
+ long added; //handles that were not in the database
+ long updated; //records replaced by a row with a newer dateLastModified
+ long kept; //rows that lost to a record or an earlier row at least as new
+} MergeResult;
+
+int merge_csv(Database * db, char const * path, int threads, MergeResult * result);
+
+void merge_database(Database * db, Database * incoming, MergeResult * result);
+
+#endif
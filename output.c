@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "output.h"
+#include "stats.h"
+
+/*
+ * starts buffering output for 'fd'
+ */
+void out_open(OutBuf *out, int fd){
+	out->fd = fd;
+	out->length = 0;
+	out->failed = 0;
+	out->dates = NULL;
+	out->data = malloc(OUT_BUFFER_SIZE);
+	if(out->data == NULL){
+		fprintf(stderr, "Failed to allocate memory for output buffer.\n");
+		exit(1);
+	}
+}
+
+/*
+ * writes out everything that is buffered
+ * @return 1 on success, 0 if a write has failed
+ */
+int out_flush(OutBuf *out){
+	char const *p = out->data;
+	size_t left = out->length;
+
+	while(left > 0 && !out->failed){
+		ssize_t written = write(out->fd, p, left);
+		if(written == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			out->failed = 1;
+			break;
+		}
+		p += written;
+		left -= written;
+	}
+	stat_count(STAT_BYTES_WRITTEN, out->length - left);
+	out->length = 0;
+	return !out->failed;
+}
+
+/*
+ * flushes and releases the buffer; the file descriptor is left open
+ * @return 1 if every byte was written, 0 otherwise
+ */
+int out_close(OutBuf *out){
+	int ok = out_flush(out);
+	free(out->data);
+	free(out->dates);
+	out->data = NULL;
+	out->dates = NULL;
+	return ok;
+}
+
+/*
+ * appends 'length' bytes
+ */
+void out_write(OutBuf *out, char const *data, size_t length){
+	if(out->length + length > OUT_BUFFER_SIZE){
+		out_flush(out);
+		if(length > OUT_BUFFER_SIZE){
+			//too big to buffer, hand it straight to write
+			char *saved = out->data;
+			out->data = (char *)data;
+			out->length = length;
+			out_flush(out);
+			out->data = saved;
+			return;
+		}
+	}
+	memcpy(out->data + out->length, data, length);
+	out->length += length;
+}
+
+/*
+ * appends a null terminated string
+ */
+void out_str(OutBuf *out, char const *str){
+	out_write(out, str, strlen(str));
+}
+
+/*
+ * appends spaces until 'count' characters were written since 'written'
+ */
+static void pad(OutBuf *out, size_t written, size_t width){
+	static char const spaces[] = "                                ";
+	while(written < width){
+		size_t n = width - written;
+		if(n > sizeof(spaces) - 1){
+			n = sizeof(spaces) - 1;
+		}
+		out_write(out, spaces, n);
+		written += n;
+	}
+}
+
+/*
+ * same output as printf("%-W.Ps", str) with W = width and P = precision
+ */
+void out_padded(OutBuf *out, char const *str, size_t precision, size_t width){
+	size_t length = strnlen(str, precision);
+	out_write(out, str, length);
+	pad(out, length, width);
+}
+
+/*
+ * same output as printf("%-Wlu", value) with W = width, 0 for no padding
+ */
+void out_ulong(OutBuf *out, unsigned long value, size_t width){
+	char digits[24];
+	char *p = digits + sizeof(digits);
+
+	do{
+		*--p = '0' + value % 10;
+		value /= 10;
+	}while(value != 0);
+
+	size_t length = digits + sizeof(digits) - p;
+	out_write(out, p, length);
+	pad(out, length, width);
+}
+
+/*
+ * same output as formatting the date with strftime("%Y-%m-%d %H:%M") and printing it with "%-Ws"
+ * localtime and strftime only run once per distinct minute held in the cache
+ */
+void out_date(OutBuf *out, time_t date, size_t width){
+	if(out->dates == NULL){
+		out->dates = calloc(1, sizeof(DateCache));
+		if(out->dates == NULL){
+			fprintf(stderr, "Failed to allocate memory for date cache.\n");
+			exit(1);
+		}
+	}
+
+	DateCache *cache = out->dates;
+	unsigned int slot = (unsigned long)(date / 60) % DATE_CACHE_SLOTS;
+
+	if(!cache->used[slot] || date < cache->start[slot] || date - cache->start[slot] >= 60){
+		struct tm tm;
+		struct tm *timeinfo = localtime_r(&date, &tm); //the server renders on several threads at once
+		if(timeinfo == NULL){
+			cache->text[slot][0] = '\0';
+			cache->start[slot] = date;
+		}else{
+			strftime(cache->text[slot], sizeof(cache->text[slot]), "%Y-%m-%d %H:%M", timeinfo);
+			//the string stays the same until the local minute changes
+			cache->start[slot] = date - timeinfo->tm_sec;
+		}
+		cache->used[slot] = 1;
+	}
+
+	out_padded(out, cache->text[slot], sizeof(cache->text[slot]), width);
+}
+
+/*
+ * appends the column names of the list table
+ */
+void out_list_header(OutBuf *out){
+	out_str(out, "HANDLE               | FOLLOWERS  | LAST MODIFIED       | COMMENT\n"); //column names
+	out_str(out, "-----------------------------------------------------------------------------\n");
+}
+
+/*
+ * appends one row of the list table
+ * same bytes as printf("%-20.20s | %-10lu | %-19s | %-30.30s\n") with the date formatted by strftime
+ */
+void out_list_record(OutBuf *out, Record const *record){
+	out_padded(out, record->handle, 20, 20); //truncates handle to only 20 characters
+	out_write(out, " | ", 3);
+	out_ulong(out, record->followerCount, 10); //long integers padded to 10 digits
+	out_write(out, " | ", 3);
+	out_date(out, record->dateLastModified, 19); //date padded to 19
+	out_write(out, " | ", 3);
+	out_padded(out, record->comment, 30, 30); //comment truncated after 30 characters
+	out_write(out, "\n", 1);
+}
+
+/*
+ * appends one record as a line of CSV
+ * same bytes as fprintf("%s,%lu,%s,%lu\n")
+ */
+void out_csv_record(OutBuf *out, Record const *record){
+	out_str(out, record->handle);
+	out_write(out, ",", 1);
+	out_ulong(out, record->followerCount, 0);
+	out_write(out, ",", 1);
+	out_str(out, record->comment);
+	out_write(out, ",", 1);
+	out_ulong(out, record->dateLastModified, 0);
+	out_write(out, "\n", 1);
+}
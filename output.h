@@ -0,0 +1,54 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <time.h>
+#include "database.h"
+
+#define OUT_BUFFER_SIZE (1 << 20)
+#define DATE_CACHE_SLOTS 1024
+
+/*
+ * formatted "%Y-%m-%d %H:%M" strings for recently seen minutes
+ * an entry is valid for the 60 seconds starting at 'start', the local minute it was computed for
+ */
+typedef struct DateCache {
+ time_t start[DATE_CACHE_SLOTS];
+ char text[DATE_CACHE_SLOTS][20];
+ char used[DATE_CACHE_SLOTS];
+} DateCache;
+
+/*
+ * output buffer that is flushed to a file descriptor with large write calls
+ */
+typedef struct OutBuf {
+ int fd;
+ char *data;
+ size_t length; //bytes waiting to be written
+ int failed; //set once a write fails; later output is dropped
+ DateCache *dates; //allocated on the first out_date call
+} OutBuf;
+
+void out_open(OutBuf * out, int fd);
+
+int out_close(OutBuf * out);
+
+int out_flush(OutBuf * out);
+
+void out_write(OutBuf * out, char const * data, size_t length);
+
+void out_str(OutBuf * out, char const * str);
+
+void out_padded(OutBuf * out, char const * str, size_t precision, size_t width);
+
+void out_ulong(OutBuf * out, unsigned long value, size_t width);
+
+void out_date(OutBuf * out, time_t date, size_t width);
+
+void out_list_header(OutBuf * out);
+
+void out_list_record(OutBuf * out, Record const * record);
+
+void out_csv_record(OutBuf * out, Record const * record);
+
+#endif
@@ -0,0 +1,494 @@
+#define _GNU_SOURCE //pthread_rwlockattr_setkind_np
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "server.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "output.h"
+#include "igdb.h"
+#include "stats.h"
+
+/*
+ * state shared by every connection
+ * commands that only read take the lock shared, so lists and lookups run side by side;
+ * add, update, save and anything that builds an index take it alone
+ */
+typedef struct Server {
+ Database *db;
+ pthread_rwlock_t lock;
+ int dirty; //1 if a change is only in memory, guarded by lock
+} Server;
+
+typedef struct Client {
+ Server *server;
+ int fd;
+} Client;
+
+//secondary indexes a read command walks; they are built lazily, which is a write
+#define NEEDS_FOLLOWERS 1
+#define NEEDS_DATES 2
+#define NEEDS_HANDLES 4
+#define NEEDS_TRIGRAMS 8
+#define NEEDS_WORDS 16
+
+static volatile sig_atomic_t stopping = 0;
+
+static void handle_stop(int sig){
+	stopping = 1;
+}
+
+/*
+ * @return the NEEDS_ flags of the indexes that exist right now
+ */
+static int built_indexes(Database *db){
+	return (db->byFollowers != NULL ? NEEDS_FOLLOWERS : 0) | (db->byDate != NULL ? NEEDS_DATES : 0)
+	       | (db->byHandle != NULL ? NEEDS_HANDLES : 0) | (db->trigrams != NULL ? NEEDS_TRIGRAMS : 0)
+	       | (db->words != NULL ? NEEDS_WORDS : 0);
+}
+
+/*
+ * builds the indexes in 'needs' that do not exist; the caller holds the lock exclusively
+ */
+static void build_indexes(Database *db, int needs){
+	if(needs & NEEDS_FOLLOWERS){
+		db_followers_index(db);
+	}
+	if(needs & NEEDS_DATES){
+		db_dates_index(db);
+	}
+	if(needs & NEEDS_HANDLES){
+		db_prefix_index(db);
+	}
+	if(needs & NEEDS_TRIGRAMS){
+		db_trigram_index(db);
+	}
+	if(needs & NEEDS_WORDS){
+		db_word_index(db);
+	}
+}
+
+/*
+ * takes the lock shared, first building the indexes in 'needs' under the exclusive lock if they do not exist yet
+ * a writer can get in between the build and the shared lock and drop them again, a delete that starts a compaction
+ * drops the handle, trigram and word indexes, so the check is repeated until they exist while the shared lock is held
+ */
+static void read_lock(Server *server, int needs){
+	Database *db = server->db;
+
+	pthread_rwlock_rdlock(&server->lock);
+	while((needs & ~built_indexes(db)) != 0){
+		pthread_rwlock_unlock(&server->lock);
+		pthread_rwlock_wrlock(&server->lock);
+		build_indexes(db, needs);
+		pthread_rwlock_unlock(&server->lock);
+		pthread_rwlock_rdlock(&server->lock);
+	}
+}
+
+/*
+ * ends a reply with "ERR message"
+ */
+static void reply_error(OutBuf *out, char const *message){
+	out_str(out, "ERR ");
+	out_str(out, message);
+	out_write(out, "\n", 1);
+}
+
+/*
+ * parses the two numbers of "range LO HI" and "count LO HI"
+ * @return NULL on success, otherwise the reason the arguments are invalid
+ */
+static const char *parse_bounds(char **save, unsigned long *lo, unsigned long *hi){
+	char *loStr = strtok_r(NULL, " \t", save);
+	char *hiStr = strtok_r(NULL, " \t", save);
+
+	if(loStr == NULL || hiStr == NULL || strtok_r(NULL, " \t", save) != NULL){
+		return "usage: range|count LO HI.";
+	}
+	const char *error = check_followers(loStr, lo);
+	if(error == NULL){
+		error = check_followers(hiStr, hi);
+	}
+	return error;
+}
+
+/*
+ * applies "add|update HANDLE FOLLOWERS COMMENT" or "delete HANDLE" under the exclusive lock
+ * a running compaction advances one step while the lock is held
+ */
+static void serve_change(Server *server, char *line, OutBuf *out){
+	BatchOp op;
+	char message[128];
+
+	memset(&op, 0, sizeof(op));
+	const char *error = parse_batch_line(line, &op);
+	if(error != NULL){
+		reply_error(out, error);
+		return;
+	}
+
+	Database *db = server->db;
+	pthread_rwlock_wrlock(&server->lock);
+	Record *rec = db_lookup(db, op.record.handle);
+	if(op.kind == JOURNAL_ADD && rec != NULL){
+		snprintf(message, sizeof(message), "Handle '%s' already exists.", op.record.handle);
+		error = message;
+	}else if(op.kind != JOURNAL_ADD && rec == NULL){
+		snprintf(message, sizeof(message), "no entry with handle %s", op.record.handle);
+		error = message;
+	}else if(op.kind == JOURNAL_DELETE){
+		Record removed = *rec;
+		char comment[COMMENT_SIZE]; //a delete can reclaim the comment's storage
+		removed.comment = strcpy(comment, rec->comment);
+		db_remove(db, op.record.handle);
+		record_change(db, JOURNAL_DELETE, &removed, &server->dirty);
+	}else if(op.kind == JOURNAL_ADD){
+		op.record.comment = op.comment;
+		op.record.dateLastModified = current_time();
+		db_append(db, &op.record);
+		record_change(db, JOURNAL_ADD, &db->records[db->size - 1], &server->dirty);
+	}else{
+		db_update_record(db, rec, op.record.followerCount, op.comment, current_time());
+		record_change(db, JOURNAL_UPDATE, rec, &server->dirty);
+	}
+	db_compact_step(db);
+	pthread_rwlock_unlock(&server->lock);
+
+	if(error != NULL){
+		reply_error(out, error);
+	}else{
+		out_str(out, "OK\n");
+	}
+}
+
+/*
+ * runs one command line from a client and writes the reply: any output, then "OK" or "ERR message"
+ * @return 0 if the client asked to close the connection, 1 otherwise
+ */
+static int serve_command(Server *server, char *line, OutBuf *out){
+	Database *db = server->db;
+	char *start = line + strspn(line, " \t");
+	size_t length = strcspn(start, " \t");
+
+	//add and update keep the rest of the line as the comment, so they are parsed as batch lines, and delete with them
+	if((length == 3 && strncmp(start, "add", 3) == 0) || (length == 6 && strncmp(start, "update", 6) == 0)
+	   || (length == 6 && strncmp(start, "delete", 6) == 0)){
+		serve_change(server, line, out);
+		return 1;
+	}
+
+	char *save;
+	char *command = strtok_r(line, " \t", &save);
+	const char *error = NULL;
+
+	if(command == NULL){
+		reply_error(out, "Command missing.");
+	}else if(strcmp(command, "quit") == 0 || strcmp(command, "exit") == 0){
+		out_str(out, "OK\n");
+		return 0;
+	}else if(strcmp(command, "get") == 0){
+		char *handle = strtok_r(NULL, " \t", &save);
+		if(handle == NULL || strtok_r(NULL, " \t", &save) != NULL){
+			reply_error(out, "usage: get HANDLE.");
+			return 1;
+		}
+		read_lock(server, 0);
+		Record *rec = db_lookup(db, handle);
+		if(rec != NULL){
+			out_list_header(out);
+			out_list_record(out, rec);
+		}
+		pthread_rwlock_unlock(&server->lock);
+		if(rec == NULL){
+			char message[128];
+			snprintf(message, sizeof(message), "no entry with handle %.64s", handle);
+			reply_error(out, message);
+		}else{
+			out_str(out, "OK\n");
+		}
+	}else if(strcmp(command, "list") == 0){
+		char *offsetStr = strtok_r(NULL, " \t", &save);
+		char *limitStr = offsetStr != NULL ? strtok_r(NULL, " \t", &save) : NULL;
+		unsigned long offset = 0;
+		unsigned long limit = ULONG_MAX;
+		if((limitStr != NULL && strtok_r(NULL, " \t", &save) != NULL)
+		   || (offsetStr != NULL && check_followers(offsetStr, &offset) != NULL)
+		   || (limitStr != NULL && check_followers(limitStr, &limit) != NULL)){
+			reply_error(out, "usage: list [OFFSET [LIMIT]].");
+			return 1;
+		}
+		read_lock(server, 0);
+		db_list(db, out, offset, limit);
+		pthread_rwlock_unlock(&server->lock);
+		out_str(out, "OK\n");
+	}else if(strcmp(command, "top") == 0){
+		char *countStr = strtok_r(NULL, " \t", &save);
+		unsigned long count;
+		if(countStr == NULL || strtok_r(NULL, " \t", &save) != NULL){
+			reply_error(out, "usage: top N.");
+			return 1;
+		}
+		if((error = check_followers(countStr, &count)) != NULL){
+			reply_error(out, error);
+			return 1;
+		}
+		read_lock(server, NEEDS_FOLLOWERS);
+		db_top(db, out, count);
+		pthread_rwlock_unlock(&server->lock);
+		out_str(out, "OK\n");
+	}else if(strcmp(command, "range") == 0 || strcmp(command, "count") == 0){
+		unsigned long lo, hi;
+		if((error = parse_bounds(&save, &lo, &hi)) != NULL){
+			reply_error(out, error);
+			return 1;
+		}
+		if(strcmp(command, "range") == 0){
+			read_lock(server, NEEDS_FOLLOWERS);
+			db_range(db, out, lo, hi);
+			pthread_rwlock_unlock(&server->lock);
+		}else{
+			char message[128];
+			read_lock(server, 0);
+			long count = db_count_followers(db, lo, hi);
+			pthread_rwlock_unlock(&server->lock);
+			snprintf(message, sizeof(message), "%ld records have between %lu and %lu followers.\n", count, lo, hi);
+			out_str(out, message);
+		}
+		out_str(out, "OK\n");
+	}else if(strcmp(command, "since") == 0){
+		char *sinceStr = strtok_r(NULL, " \t", &save);
+		unsigned long since;
+		if(sinceStr == NULL || strtok_r(NULL, " \t", &save) != NULL){
+			reply_error(out, "usage: since TIMESTAMP.");
+			return 1;
+		}
+		if(check_followers(sinceStr, &since) != NULL){
+			reply_error(out, "TIMESTAMP must be a number of seconds since the epoch.");
+			return 1;
+		}
+		read_lock(server, NEEDS_DATES);
+		db_since(db, out, since);
+		pthread_rwlock_unlock(&server->lock);
+		out_str(out, "OK\n");
+	}else if(strcmp(command, "find") == 0 || strcmp(command, "grep") == 0){
+		int find = strcmp(command, "find") == 0;
+		char *pattern = strtok_r(NULL, " \t", &save);
+		if(pattern == NULL || strtok_r(NULL, " \t", &save) != NULL){
+			reply_error(out, find ? "usage: find PREFIX." : "usage: grep SUBSTR.");
+			return 1;
+		}
+		read_lock(server, find ? NEEDS_HANDLES : NEEDS_TRIGRAMS);
+		if(find){
+			db_find(db, out, pattern);
+		}else{
+			db_grep(db, out, pattern);
+		}
+		pthread_rwlock_unlock(&server->lock);
+		out_str(out, "OK\n");
+	}else if(strcmp(command, "search") == 0){
+		read_lock(server, NEEDS_WORDS);
+		int searched = db_search(db, out, save != NULL ? save : "");
+		pthread_rwlock_unlock(&server->lock);
+		if(searched){
+			out_str(out, "OK\n");
+		}else{
+			reply_error(out, "usage: search WORD....");
+		}
+	}else if(strcmp(command, "stats") == 0){
+		char *subject = strtok_r(NULL, " \t", &save);
+		if((subject != NULL && strcmp(subject, "followers") != 0) || strtok_r(NULL, " \t", &save) != NULL){
+			reply_error(out, "usage: stats [followers].");
+			return 1;
+		}
+		if(subject != NULL){
+			read_lock(server, 0);
+			db_stats_followers(db, out);
+			pthread_rwlock_unlock(&server->lock);
+		}else{
+			stats_print(out); //the counters are per thread and need no lock
+		}
+		out_str(out, "OK\n");
+	}else if(strcmp(command, "histogram") == 0){
+		char *bucketsStr = strtok_r(NULL, " \t", &save);
+		unsigned long buckets;
+		if(bucketsStr == NULL || strtok_r(NULL, " \t", &save) != NULL){
+			reply_error(out, "usage: histogram BUCKETS.");
+			return 1;
+		}
+		if(check_followers(bucketsStr, &buckets) != NULL || buckets < 1 || buckets > HISTOGRAM_MAX_BUCKETS){
+			reply_error(out, "BUCKETS must be between 1 and 1000.");
+			return 1;
+		}
+		read_lock(server, 0);
+		db_histogram(db, out, (int)buckets);
+		pthread_rwlock_unlock(&server->lock);
+		out_str(out, "OK\n");
+	}else if(strcmp(command, "merge") == 0){
+		char *path = strtok_r(NULL, " \t", &save);
+		if(path == NULL || strtok_r(NULL, " \t", &save) != NULL){
+			reply_error(out, "usage: merge PATH.");
+			return 1;
+		}
+		pthread_rwlock_wrlock(&server->lock);
+		int built = built_indexes(db);
+		int merged = db_merge(db, out, path, &server->dirty);
+		build_indexes(db, built); //a large merge drops the indexes; readers find them as they were
+		pthread_rwlock_unlock(&server->lock);
+		if(merged){
+			out_str(out, "OK\n");
+		}else{
+			reply_error(out, "unable to read the file.");
+		}
+	}else if(strcmp(command, "save") == 0){
+		if(strtok_r(NULL, " \t", &save) != NULL){
+			reply_error(out, "'save' command does not take any arguments.");
+			return 1;
+		}
+		pthread_rwlock_wrlock(&server->lock);
+		int saved = db_save(db);
+		if(saved){
+			server->dirty = 0;
+		}
+		pthread_rwlock_unlock(&server->lock);
+		if(saved){
+			out_str(out, "OK\n");
+		}else{
+			reply_error(out, "save failed.");
+		}
+	}else{
+		reply_error(out, "Unrecognized command.");
+	}
+	return 1;
+}
+
+/*
+ * connection thread: answers commands one line at a time until the client hangs up
+ */
+static void *serve_client(void *arg){
+	Client *client = arg;
+	FILE *in = fdopen(client->fd, "r");
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t nread;
+	OutBuf out;
+
+	if(in == NULL){
+		close(client->fd);
+		free(client);
+		return NULL;
+	}
+	out_open(&out, client->fd);
+	while(!stopping && (nread = getline(&line, &len, in)) != -1){
+		line[strcspn(line, "\r\n")] = '\0';
+		int keep = serve_command(client->server, line, &out);
+		if(!out_flush(&out) || !keep){
+			break;
+		}
+	}
+	out_close(&out);
+	free(line);
+	fclose(in);
+	free(client);
+	return NULL;
+}
+
+/*
+ * serves the database on a Unix domain socket until SIGINT or SIGTERM, then saves it if it has unsaved changes
+ * @param *socketPath where the socket is created; a stale socket left there is replaced
+ * @param int dirty 1 if the database already has changes that are not on disk
+ * @return 0 on a clean shutdown, 1 if the socket could not be set up or the final save failed
+ */
+int server_run(Database *db, char const *socketPath, int dirty){
+	Server server;
+	struct sockaddr_un addr;
+	struct stat st;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(socketPath) >= sizeof(addr.sun_path)){
+		fprintf(stderr, "Error: socket path '%s' is too long.\n", socketPath);
+		return 1;
+	}
+	strcpy(addr.sun_path, socketPath);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd == -1){
+		fprintf(stderr, "Error: unable to create a socket.\n");
+		return 1;
+	}
+	if(stat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode)){
+		unlink(socketPath); //left behind by a server that did not shut down cleanly
+	}
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, SERVER_BACKLOG) == -1){
+		fprintf(stderr, "Error: unable to listen on '%s'.\n", socketPath);
+		close(fd);
+		return 1;
+	}
+
+	//writers are preferred so a steady stream of lists cannot hold off an update forever
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&server.lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+	server.db = db;
+	server.dirty = dirty;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_stop;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN); //a client that hangs up mid reply only ends its own connection
+
+	printf("Serving %d records on %s.\n", db_live_records(db), socketPath);
+	fflush(stdout);
+
+	while(!stopping){
+		struct pollfd ready = { fd, POLLIN, 0 };
+		if(poll(&ready, 1, 250) <= 0){ //wakes up regularly to notice a stop request
+			continue;
+		}
+		int clientFd = accept(fd, NULL, NULL);
+		if(clientFd == -1){
+			continue;
+		}
+
+		Client *client = malloc(sizeof(Client));
+		if(client == NULL){
+			fprintf(stderr, "Failed memory allocation.\n");
+			exit(1);
+		}
+		client->server = &server;
+		client->fd = clientFd;
+
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, serve_client, client) != 0){
+			fprintf(stderr, "Error: unable to start a connection thread.\n");
+			close(clientFd);
+			free(client);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+
+	close(fd);
+	unlink(socketPath);
+
+	//waits for commands in progress; the lock is never released, connections still open get no more answers
+	pthread_rwlock_wrlock(&server.lock);
+	printf("Shutting down.\n");
+	if(server.dirty && !db_save(db)){
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "database.h"
+
+#define SERVER_BACKLOG 64
+
+int server_run(Database * db, char const * socketPath, int dirty);
+
+#endif
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+_Static_assert(sizeof(SnapshotHeader) == 64, "snapshot header must stay 64 bytes");
+
+//records are copied this many at a time so their comment pointers can be swapped for their address in the file
+#define SNAPSHOT_BATCH 4096
+
+/*
+ * @param *path file to check
+ * @return 1 if the file starts with the snapshot magic bytes, 0 otherwise
+ */
+int snapshot_detect(char const *path){
+	char magic[sizeof(((SnapshotHeader *)0)->magic)];
+	FILE *file = fopen(path, "rb");
+
+	if(file == NULL){
+		return 0;
+	}
+	size_t nread = fread(magic, 1, sizeof(magic), file);
+	fclose(file);
+
+	return nread == sizeof(magic) && memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+}
+
+/*
+ * folds 'length' bytes into a running checksum, eight bytes at a time
+ * @param checksum value returned by the previous call, 0 for the first one
+ * @return the updated checksum
+ */
+unsigned long snapshot_checksum(void const *data, size_t length, unsigned long checksum){
+	unsigned char const *bytes = data;
+	size_t i = 0;
+
+	for(; i + 8 <= length; i += 8){
+		unsigned long word;
+		memcpy(&word, bytes + i, 8);
+		checksum = (checksum ^ word) * 0x100000001b3UL;
+	}
+	for(; i < length; i++){
+		checksum = (checksum ^ bytes[i]) * 0x100000001b3UL;
+	}
+	return checksum;
+}
+
+/*
+ * maps the snapshot at 'path' and points the records and index of the empty database 'db' straight into it
+ * nothing is parsed and, when the file gets the address it asks for, nothing in the mapping is written:
+ * startup reads the file once for the checksum and the records once more to check their comments
+ * if the address is taken the comments are moved, which writes every page of records
+ * @return 1 on success, 0 if the file is missing, truncated, corrupt or from an incompatible build
+ */
+int snapshot_load(Database *db, char const *path){
+	int fd = open(path, O_RDONLY);
+	if(fd == -1){
+		fprintf(stderr, "No file %s exists, failed to read from %s, returning early\n", path, path);
+		return 0;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(SnapshotHeader)){
+		fprintf(stderr, "Error: %s is too short to be a snapshot.\n", path);
+		close(fd);
+		return 0;
+	}
+
+	//the stored comment pointers are only valid at the address the header asks for, which is only a hint to mmap
+	SnapshotHeader wanted;
+	if(pread(fd, &wanted, sizeof(wanted), 0) != sizeof(wanted)){
+		fprintf(stderr, "Error: failed to read %s.\n", path);
+		close(fd);
+		return 0;
+	}
+
+	//private writable mapping: updates change the pages in memory, never the file
+	char *data = mmap((void *)(uintptr_t)wanted.base, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED){
+		fprintf(stderr, "Error: failed to map %s.\n", path);
+		return 0;
+	}
+
+	SnapshotHeader const *header = (SnapshotHeader const *)data;
+	size_t recordBytes = (size_t)header->size * sizeof(Record);
+	size_t indexBytes = (size_t)header->indexCapacity * sizeof(IndexSlot);
+	size_t stringBytes = header->stringBytes;
+
+	if(memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->version != SNAPSHOT_VERSION
+	   || header->recordSize != sizeof(Record) || header->slotSize != sizeof(IndexSlot)){
+		fprintf(stderr, "Error: %s is not a snapshot this version of igdb can read.\n", path);
+		munmap(data, st.st_size);
+		return 0;
+	}
+	if(header->size < 0 || header->indexCapacity <= 0 || (header->indexCapacity & (header->indexCapacity - 1)) != 0
+	   || header->indexCount > header->indexCapacity / 2 || stringBytes > (size_t)st.st_size
+	   || sizeof(SnapshotHeader) + recordBytes + indexBytes + stringBytes != (size_t)st.st_size){
+		fprintf(stderr, "Error: snapshot %s is truncated or has a bad header.\n", path);
+		munmap(data, st.st_size);
+		return 0;
+	}
+	if(snapshot_checksum(data + sizeof(SnapshotHeader), recordBytes + indexBytes + stringBytes, 0) != header->checksum){
+		fprintf(stderr, "Error: snapshot %s is corrupt, checksum mismatch.\n", path);
+		munmap(data, st.st_size);
+		return 0;
+	}
+
+	Record *records = (Record *)(data + sizeof(SnapshotHeader));
+	char const *strings = data + sizeof(SnapshotHeader) + recordBytes + indexBytes;
+	if(header->size > 0 && (stringBytes == 0 || strings[stringBytes - 1] != '\0')){
+		fprintf(stderr, "Error: snapshot %s has a bad string section.\n", path);
+		munmap(data, st.st_size);
+		return 0;
+	}
+	uintptr_t storedStrings = header->base + (strings - data);
+	int moved = data != (char *)(uintptr_t)header->base;
+	for(int i = 0; i < header->size; i++){
+		if(memchr(records[i].handle, '\0', sizeof(records[i].handle)) == NULL){
+			fprintf(stderr, "Error: snapshot %s has a bad record.\n", path);
+			munmap(data, st.st_size);
+			return 0;
+		}
+		uintptr_t offset = (uintptr_t)records[i].comment - storedStrings;
+		if(offset >= stringBytes){
+			fprintf(stderr, "Error: snapshot %s has a bad string section.\n", path);
+			munmap(data, st.st_size);
+			return 0;
+		}
+		if(moved){
+			records[i].comment = strings + offset;
+		}
+	}
+
+	//every lookup follows the index into records, so each slot must be empty or name a record that exists
+	IndexSlot const *index = (IndexSlot const *)(data + sizeof(SnapshotHeader) + recordBytes);
+	int occupied = 0;
+	for(int i = 0; i < header->indexCapacity; i++){
+		if(index[i].record < -1 || index[i].record >= header->size){
+			occupied = -1;
+			break;
+		}
+		occupied += index[i].record != -1;
+	}
+	if(occupied != header->indexCount){
+		fprintf(stderr, "Error: snapshot %s has a bad index.\n", path);
+		munmap(data, st.st_size);
+		return 0;
+	}
+
+	//the arrays db_create allocated are replaced by the mapped ones
+	free(db->records);
+	free(db->index);
+
+	//the stored comments are distinct, so they can join the intern table as they are once something is interned
+	arena_adopt(&db->strings, strings, stringBytes);
+
+	db->mapping = data;
+	db->mappingLength = st.st_size;
+	db->records = records;
+	db->size = header->size;
+	db->capacity = header->size; //the next append moves the records out of the mapping
+	db->index = (IndexSlot *)index;
+	db->indexCapacity = header->indexCapacity;
+	db->indexCount = header->indexCount;
+	return 1;
+}
+
+/*
+ * writes 'length' bytes to fd, retrying short writes
+ * @return 1 on success, 0 on failure
+ */
+static int write_all(int fd, void const *data, size_t length){
+	char const *p = data;
+	while(length > 0){
+		ssize_t written = write(fd, p, length);
+		if(written == -1){
+			return 0;
+		}
+		p += written;
+		length -= written;
+	}
+	return 1;
+}
+
+/*
+ * writes the database to 'path' as a snapshot
+ * the file is written under a temporary name and renamed into place, so a crash leaves the old snapshot intact
+ * the format has no room for deleted records, so any are compacted away first
+ * @return 1 on success, 0 on failure
+ */
+int snapshot_write(Database *db, char const *path){
+	SnapshotHeader header;
+	db_compact(db);
+	size_t indexBytes = (size_t)db->indexCapacity * sizeof(IndexSlot);
+
+	//offset of each live comment in the strings section, by intern table slot
+	arena_adopt_pending(&db->strings);
+	size_t *offsets = malloc((db->strings.tableCapacity + 1) * sizeof(size_t));
+	size_t stringCapacity = 4096;
+	char *strings = malloc(stringCapacity);
+	Record *batch = malloc(SNAPSHOT_BATCH * sizeof(Record));
+	char *tmpPath = malloc(strlen(path) + 5);
+	if(offsets == NULL || strings == NULL || batch == NULL || tmpPath == NULL){
+		fprintf(stderr, "Failed memory allocation.\n");
+		exit(1);
+	}
+	memset(offsets, 0xff, db->strings.tableCapacity * sizeof(size_t)); //(size_t)-1 marks a comment not stored yet
+	sprintf(tmpPath, "%s.tmp", path);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.recordSize = sizeof(Record);
+	header.slotSize = sizeof(IndexSlot);
+	header.size = db->size;
+	header.indexCapacity = db->indexCapacity;
+	header.indexCount = db->indexCount;
+	header.base = SNAPSHOT_BASE;
+	uintptr_t storedStrings = SNAPSHOT_BASE + sizeof(header) + (size_t)db->size * sizeof(Record) + indexBytes;
+
+	int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd == -1){
+		fprintf(stderr, "Error: unable to create '%s'.\n", tmpPath);
+		free(offsets);
+		free(strings);
+		free(batch);
+		free(tmpPath);
+		return 0;
+	}
+
+	//the header goes first as a placeholder and is rewritten once the checksum is known
+	int ok = write_all(fd, &header, sizeof(header));
+	unsigned long checksum = 0;
+	size_t stringBytes = 0;
+
+	for(int start = 0; ok && start < db->size; start += SNAPSHOT_BATCH){
+		int count = db->size - start < SNAPSHOT_BATCH ? db->size - start : SNAPSHOT_BATCH;
+		memcpy(batch, &db->records[start], count * sizeof(Record));
+		for(int i = 0; i < count; i++){
+			long slot = arena_slot(&db->strings, batch[i].comment);
+			if(slot == -1){
+				fprintf(stderr, "Error: record '%s' has a comment outside the string table.\n", batch[i].handle);
+				exit(1);
+			}
+			if(offsets[slot] == (size_t)-1){
+				size_t length = strlen(batch[i].comment) + 1;
+				while(stringBytes + length > stringCapacity){
+					stringCapacity *= 2;
+					strings = realloc(strings, stringCapacity);
+					if(strings == NULL){
+						fprintf(stderr, "Failed memory allocation.\n");
+						exit(1);
+					}
+				}
+				memcpy(strings + stringBytes, batch[i].comment, length);
+				offsets[slot] = stringBytes;
+				stringBytes += length;
+			}
+			batch[i].comment = (char const *)(storedStrings + offsets[slot]);
+		}
+		checksum = snapshot_checksum(batch, count * sizeof(Record), checksum);
+		ok = write_all(fd, batch, count * sizeof(Record));
+	}
+
+	checksum = snapshot_checksum(db->index, indexBytes, checksum);
+	checksum = snapshot_checksum(strings, stringBytes, checksum);
+	header.checksum = checksum;
+	header.stringBytes = stringBytes;
+
+	ok = ok && write_all(fd, db->index, indexBytes)
+	        && write_all(fd, strings, stringBytes)
+	        && pwrite(fd, &header, sizeof(header), 0) == sizeof(header)
+	        && fsync(fd) == 0;
+	ok = close(fd) == 0 && ok;
+	if(ok && rename(tmpPath, path) != 0){
+		ok = 0;
+	}
+	if(!ok){
+		fprintf(stderr, "Error: failed to write snapshot '%s'.\n", path);
+		unlink(tmpPath);
+	}
+
+	free(offsets);
+	free(strings);
+	free(batch);
+	free(tmpPath);
+	return ok;
+}
@@ -0,0 +1,42 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "database.h"
+
+#define SNAPSHOT_MAGIC "IGDBSNAP"
+#define SNAPSHOT_VERSION 3
+
+//address snapshots are written to be mapped at; far from where the heap, the program and the kernel's own choices go
+#define SNAPSHOT_BASE 0x600000000000UL
+
+/*
+ * layout of a snapshot file:
+ * header | records, fixed width Record array | index, IndexSlot array | strings
+ * each record stores the address its comment has when the file is mapped at 'base',
+ * so a file that gets that address is used without touching the records; anywhere else the comments are moved
+ * strings holds every distinct comment once, null terminated
+ * everything is stored in host byte order so the file can be mapped and used as is
+ */
+typedef struct SnapshotHeader {
+ char magic[8]; //SNAPSHOT_MAGIC without the null terminator
+ unsigned int version; //SNAPSHOT_VERSION
+ unsigned int recordSize; //sizeof(Record), guards against layout changes
+ unsigned int slotSize; //sizeof(IndexSlot)
+ int size; //number of records
+ int indexCapacity; //number of index slots
+ int indexCount; //number of occupied index slots
+ unsigned long checksum; //snapshot_checksum of everything after the header
+ unsigned long stringBytes; //length of the strings section
+ unsigned long base; //address the comment pointers were stored for, SNAPSHOT_BASE when written
+ char reserved[8]; //pads the header to 64 bytes so the records stay aligned
+} SnapshotHeader;
+
+int snapshot_detect(char const * path);
+
+int snapshot_load(Database * db, char const * path);
+
+int snapshot_write(Database * db, char const * path);
+
+unsigned long snapshot_checksum(void const * data, size_t length, unsigned long checksum);
+
+#endif
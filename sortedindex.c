@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "sortedindex.h"
+
+/*
+ * allocates a node with room for 'level' forward pointers
+ */
+static SortedNode *new_node(unsigned long key, int id, int level){
+	SortedNode *node = malloc(sizeof(SortedNode) + level * sizeof(SortedNode *));
+	if(node == NULL){
+		fprintf(stderr, "Failed to allocate memory for index.\n");
+		exit(1);
+	}
+	node->key = key;
+	node->id = id;
+	node->level = level;
+	node->prev = NULL;
+	for(int i = 0; i < level; i++){
+		node->next[i] = NULL;
+	}
+	return node;
+}
+
+/*
+ * creates an empty index
+ */
+SortedIndex *sorted_create(){
+	SortedIndex *index = malloc(sizeof(SortedIndex));
+	if(index == NULL){
+		fprintf(stderr, "Failed to allocate memory for index.\n");
+		exit(1);
+	}
+	index->head = new_node(0, -1, SORTED_MAX_LEVEL);
+	index->last = NULL;
+	index->level = 1;
+	index->size = 0;
+	index->random = 2463534242u;
+	return index;
+}
+
+/*
+ * releases every entry and the index itself
+ */
+void sorted_free(SortedIndex *index){
+	if(index == NULL){
+		return;
+	}
+	SortedNode *node = index->head;
+	while(node != NULL){
+		SortedNode *next = node->next[0];
+		free(node);
+		node = next;
+	}
+	free(index);
+}
+
+/*
+ * picks a level for a new node: each extra level has probability 1/4
+ */
+static int random_level(SortedIndex *index){
+	int level = 1;
+	unsigned int x = index->random;
+
+	x ^= x << 13; //xorshift32
+	x ^= x >> 17;
+	x ^= x << 5;
+	index->random = x;
+
+	while((x & 3) == 0 && level < SORTED_MAX_LEVEL){
+		level++;
+		x >>= 2;
+	}
+	return level;
+}
+
+/*
+ * @return 1 if the node sorts before (key, id)
+ */
+static int before(SortedNode const *node, unsigned long key, int id){
+	return node->key < key || (node->key == key && node->id < id);
+}
+
+/*
+ * fills update[] with the last node before (key, id) at every level
+ */
+static void find_path(SortedIndex *index, unsigned long key, int id, SortedNode **update){
+	SortedNode *node = index->head;
+	for(int i = index->level - 1; i >= 0; i--){
+		while(node->next[i] != NULL && before(node->next[i], key, id)){
+			node = node->next[i];
+		}
+		update[i] = node;
+	}
+}
+
+/*
+ * adds the entry (key, id)
+ */
+void sorted_insert(SortedIndex *index, unsigned long key, int id){
+	SortedNode *update[SORTED_MAX_LEVEL];
+	find_path(index, key, id, update);
+
+	int level = random_level(index);
+	for(int i = index->level; i < level; i++){
+		update[i] = index->head;
+	}
+	if(level > index->level){
+		index->level = level;
+	}
+
+	SortedNode *node = new_node(key, id, level);
+	for(int i = 0; i < level; i++){
+		node->next[i] = update[i]->next[i];
+		update[i]->next[i] = node;
+	}
+	node->prev = update[0] == index->head ? NULL : update[0];
+	if(node->next[0] != NULL){
+		node->next[0]->prev = node;
+	}else{
+		index->last = node;
+	}
+	index->size++;
+}
+
+/*
+ * removes the entry (key, id)
+ * @return 1 if it was found, 0 otherwise
+ */
+int sorted_remove(SortedIndex *index, unsigned long key, int id){
+	SortedNode *update[SORTED_MAX_LEVEL];
+	find_path(index, key, id, update);
+
+	SortedNode *node = update[0]->next[0];
+	if(node == NULL || node->key != key || node->id != id){
+		return 0;
+	}
+
+	for(int i = 0; i < node->level; i++){
+		update[i]->next[i] = node->next[i];
+	}
+	if(node->next[0] != NULL){
+		node->next[0]->prev = node->prev;
+	}else{
+		index->last = node->prev;
+	}
+	while(index->level > 1 && index->head->next[index->level - 1] == NULL){
+		index->level--;
+	}
+
+	free(node);
+	index->size--;
+	return 1;
+}
+
+/*
+ * fills an empty index from entries that are already sorted by key and id, in linear time
+ */
+void sorted_build(SortedIndex *index, unsigned long const *keys, int const *ids, int count){
+	SortedNode *tail[SORTED_MAX_LEVEL];
+	for(int i = 0; i < SORTED_MAX_LEVEL; i++){
+		tail[i] = index->head;
+	}
+
+	for(int i = 0; i < count; i++){
+		int level = random_level(index);
+		SortedNode *node = new_node(keys[i], ids[i], level);
+		for(int j = 0; j < level; j++){
+			tail[j]->next[j] = node;
+			tail[j] = node;
+		}
+		if(level > index->level){
+			index->level = level;
+		}
+		node->prev = index->last;
+		index->last = node;
+	}
+	index->size += count;
+}
+
+/*
+ * @return the first entry whose key is at least 'key', or NULL if there is none
+ */
+SortedNode *sorted_seek(SortedIndex *index, unsigned long key){
+	SortedNode *node = index->head;
+	for(int i = index->level - 1; i >= 0; i--){
+		while(node->next[i] != NULL && node->next[i]->key < key){
+			node = node->next[i];
+		}
+	}
+	return node->next[0];
+}
+
+/*
+ * @return the entry with the smallest key, NULL if the index is empty
+ */
+SortedNode *sorted_first(SortedIndex *index){
+	return index->head->next[0];
+}
+
+/*
+ * @return the entry with the largest key, NULL if the index is empty
+ */
+SortedNode *sorted_last(SortedIndex *index){
+	return index->last;
+}
+
+/*
+ * @return the entry after 'node', NULL at the end
+ */
+SortedNode *sorted_next(SortedNode *node){
+	return node->next[0];
+}
+
+/*
+ * @return the entry before 'node', NULL at the start
+ */
+SortedNode *sorted_prev(SortedNode *node){
+	return node->prev;
+}
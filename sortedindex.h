@@ -0,0 +1,49 @@
+#ifndef SORTEDINDEX_H
+#define SORTEDINDEX_H
+
+#define SORTED_MAX_LEVEL 24
+
+/*
+ * one entry of a SortedIndex; entries are ordered by key and then by id
+ */
+typedef struct SortedNode {
+ unsigned long key;
+ int id; //record number the key belongs to
+ int level; //number of forward pointers
+ struct SortedNode *prev; //previous entry, NULL for the first one
+ struct SortedNode *next[]; //next entry at each level
+} SortedNode;
+
+/*
+ * ordered multimap from an unsigned long key to record numbers, implemented as a skip list
+ * insert, remove and seek take O(log n) expected time; walking to a neighbour is O(1)
+ */
+typedef struct SortedIndex {
+ SortedNode *head; //sentinel before the first entry, has SORTED_MAX_LEVEL forward pointers
+ SortedNode *last; //last entry, NULL if the index is empty
+ int level; //highest level in use
+ int size; //number of entries
+ unsigned int random; //state of the level generator
+} SortedIndex;
+
+SortedIndex *sorted_create();
+
+void sorted_free(SortedIndex * index);
+
+void sorted_insert(SortedIndex * index, unsigned long key, int id);
+
+int sorted_remove(SortedIndex * index, unsigned long key, int id);
+
+void sorted_build(SortedIndex * index, unsigned long const * keys, int const * ids, int count);
+
+SortedNode *sorted_seek(SortedIndex * index, unsigned long key);
+
+SortedNode *sorted_first(SortedIndex * index);
+
+SortedNode *sorted_last(SortedIndex * index);
+
+SortedNode *sorted_next(SortedNode * node);
+
+SortedNode *sorted_prev(SortedNode * node);
+
+#endif
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "stats.h"
+
+__thread Stats *statsLocal = NULL;
+
+static Stats *allStats = NULL; //guarded by statsLock
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t statsKey;
+static pthread_once_t statsOnce = PTHREAD_ONCE_INIT;
+
+static char const *counterNames[STAT_COUNTERS] = {
+	"lookups", "lookup_misses", "appends", "record_resizes", "index_resizes", "bytes_parsed", "bytes_written"
+};
+
+static char const *histogramNames[STAT_HISTOGRAMS] = {
+	"lookup_probes", "load_csv_ns", "write_csv_ns", "read_comment_ns"
+};
+
+/*
+ * thread exit: the block keeps its counts and waits for the next thread
+ */
+static void stats_detach(void *arg){
+	Stats *stats = arg;
+
+	pthread_mutex_lock(&statsLock);
+	stats->inUse = 0;
+	pthread_mutex_unlock(&statsLock);
+}
+
+static void stats_init(void){
+	pthread_key_create(&statsKey, stats_detach);
+}
+
+/*
+ * gives the calling thread a statistics block, reusing one left by a thread that exited
+ */
+Stats *stats_attach(void){
+	Stats *stats;
+
+	pthread_once(&statsOnce, stats_init);
+	pthread_mutex_lock(&statsLock);
+	for(stats = allStats; stats != NULL && stats->inUse; stats = stats->next){
+	}
+	if(stats == NULL){
+		stats = calloc(1, sizeof(Stats));
+		if(stats == NULL){
+			fprintf(stderr, "Failed to allocate memory for statistics.\n");
+			exit(1);
+		}
+		stats->next = allStats;
+		allStats = stats;
+	}
+	stats->inUse = 1;
+	pthread_mutex_unlock(&statsLock);
+
+	pthread_setspecific(statsKey, stats);
+	statsLocal = stats;
+	return stats;
+}
+
+/*
+ * @return index of the log2 bucket 'value' falls into
+ */
+static int bucket_of(unsigned long value){
+	return value == 0 ? 0 : 64 - __builtin_clzl(value);
+}
+
+/*
+ * adds one value to a histogram of the calling thread
+ */
+void stat_record(int histogram, unsigned long value){
+	Stats *stats = statsLocal != NULL ? statsLocal : stats_attach();
+	StatHistogram *h = &stats->histograms[histogram];
+	int bucket = bucket_of(value);
+
+	__atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->sum, h->sum + value, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->buckets[bucket], h->buckets[bucket] + 1, __ATOMIC_RELAXED);
+	if(value > h->max){
+		__atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * @return monotonic time in nanoseconds, for timing with stat_record
+ */
+unsigned long stat_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/*
+ * sums the blocks of every thread into 'total'
+ * other threads may keep counting meanwhile, so the figures are a close but not atomic snapshot
+ */
+void stats_total(Stats *total){
+	memset(total, 0, sizeof(*total));
+
+	pthread_mutex_lock(&statsLock);
+	for(Stats *stats = allStats; stats != NULL; stats = stats->next){
+		for(int i = 0; i < STAT_COUNTERS; i++){
+			total->counters[i] += __atomic_load_n(&stats->counters[i], __ATOMIC_RELAXED);
+		}
+		for(int i = 0; i < STAT_HISTOGRAMS; i++){
+			StatHistogram *from = &stats->histograms[i];
+			StatHistogram *to = &total->histograms[i];
+			to->count += __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+			to->sum += __atomic_load_n(&from->sum, __ATOMIC_RELAXED);
+			unsigned long max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+			if(max > to->max){
+				to->max = max;
+			}
+			for(int b = 0; b < STAT_BUCKETS; b++){
+				to->buckets[b] += __atomic_load_n(&from->buckets[b], __ATOMIC_RELAXED);
+			}
+		}
+	}
+	pthread_mutex_unlock(&statsLock);
+}
+
+/*
+ * @return upper bound of the bucket holding the given fraction of the values, capped at the maximum
+ */
+static unsigned long percentile(StatHistogram const *h, double fraction){
+	unsigned long rank = (unsigned long)(h->count * fraction);
+	unsigned long seen = 0;
+
+	for(int b = 0; b < STAT_BUCKETS; b++){
+		seen += h->buckets[b];
+		if(seen > rank){
+			unsigned long bound = b == 0 ? 0 : b >= 64 ? ~0UL : (1UL << b) - 1;
+			return bound < h->max ? bound : h->max;
+		}
+	}
+	return h->max;
+}
+
+/*
+ * appends a readable summary of every counter and histogram
+ */
+void stats_print(OutBuf *out){
+	Stats total;
+	char line[160];
+
+	stats_total(&total);
+	for(int i = 0; i < STAT_COUNTERS; i++){
+		snprintf(line, sizeof(line), "%-16s %lu\n", counterNames[i], total.counters[i]);
+		out_str(out, line);
+	}
+	for(int i = 0; i < STAT_HISTOGRAMS; i++){
+		StatHistogram const *h = &total.histograms[i];
+		snprintf(line, sizeof(line), "%-16s count %lu, mean %.1f, p50 <= %lu, p99 <= %lu, max %lu\n", histogramNames[i],
+		         h->count, h->count > 0 ? (double)h->sum / h->count : 0.0, percentile(h, 0.5), percentile(h, 0.99), h->max);
+		out_str(out, line);
+	}
+}
+
+/*
+ * writes every counter and histogram to 'path' as JSON; histograms list their non-empty buckets by upper bound
+ * @return 1 on success, 0 if the file could not be written
+ */
+int stats_write_json(char const *path){
+	Stats total;
+	FILE *file = fopen(path, "w");
+
+	if(file == NULL){
+		fprintf(stderr, "Error: unable to open or create file '%s'.\n", path);
+		return 0;
+	}
+	stats_total(&total);
+
+	fprintf(file, "{\n  \"counters\": {");
+	for(int i = 0; i < STAT_COUNTERS; i++){
+		fprintf(file, "%s\n    \"%s\": %lu", i == 0 ? "" : ",", counterNames[i], total.counters[i]);
+	}
+	fprintf(file, "\n  },\n  \"histograms\": {");
+	for(int i = 0; i < STAT_HISTOGRAMS; i++){
+		StatHistogram const *h = &total.histograms[i];
+		fprintf(file, "%s\n    \"%s\": {\"count\": %lu, \"sum\": %lu, \"max\": %lu, \"p50\": %lu, \"p99\": %lu, \"buckets\": {",
+		        i == 0 ? "" : ",", histogramNames[i], h->count, h->sum, h->max, percentile(h, 0.5), percentile(h, 0.99));
+		int first = 1;
+		for(int b = 0; b < STAT_BUCKETS; b++){
+			if(h->buckets[b] != 0){
+				unsigned long bound = b == 0 ? 0 : b >= 64 ? ~0UL : (1UL << b) - 1;
+				fprintf(file, "%s\"%lu\": %lu", first ? "" : ", ", bound, h->buckets[b]);
+				first = 0;
+			}
+		}
+		fprintf(file, "}}");
+	}
+	fprintf(file, "\n  }\n}\n");
+
+	int ok = !ferror(file);
+	ok = fclose(file) == 0 && ok;
+	if(!ok){
+		fprintf(stderr, "Error: failed to write '%s'.\n", path);
+	}
+	return ok;
+}
@@ -0,0 +1,66 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "output.h"
+
+//event counters
+#define STAT_LOOKUPS 0
+#define STAT_LOOKUP_MISSES 1
+#define STAT_APPENDS 2 //records added by db_append or a loader
+#define STAT_RECORD_RESIZES 3
+#define STAT_INDEX_RESIZES 4
+#define STAT_BYTES_PARSED 5
+#define STAT_BYTES_WRITTEN 6
+#define STAT_COUNTERS 7
+
+//distributions, recorded as log2 histograms
+#define STAT_LOOKUP_PROBES 0 //slots visited per db_lookup
+#define STAT_LOAD_NS 1 //time in db_load_csv
+#define STAT_WRITE_NS 2 //time in db_write_csv
+#define STAT_COMMENT_NS 3 //time in read_validated_comment, mostly waiting for the user
+#define STAT_HISTOGRAMS 4
+
+#define STAT_BUCKETS 65 //bucket b holds values v with 2^(b-1) <= v < 2^b, bucket 0 holds 0
+
+typedef struct StatHistogram {
+ unsigned long count;
+ unsigned long sum;
+ unsigned long max;
+ unsigned long buckets[STAT_BUCKETS];
+} StatHistogram;
+
+/*
+ * one thread's statistics; only that thread writes them, so updates need no atomic read-modify-write
+ * blocks are never freed: a thread that exits hands its block, counts included, to the next new thread
+ */
+typedef struct Stats {
+ unsigned long counters[STAT_COUNTERS];
+ StatHistogram histograms[STAT_HISTOGRAMS];
+ struct Stats *next; //every block ever created
+ int inUse; //1 while a live thread owns the block
+} Stats;
+
+extern __thread Stats *statsLocal;
+
+Stats *stats_attach(void);
+
+/*
+ * adds n to a counter of the calling thread
+ * relaxed atomic store of a plain sum: as cheap as an ordinary increment, and stats_total never reads a torn value
+ */
+static inline void stat_count(int counter, unsigned long n){
+	Stats *stats = statsLocal != NULL ? statsLocal : stats_attach();
+	__atomic_store_n(&stats->counters[counter], stats->counters[counter] + n, __ATOMIC_RELAXED);
+}
+
+void stat_record(int histogram, unsigned long value);
+
+unsigned long stat_now(void);
+
+void stats_total(Stats * total);
+
+void stats_print(OutBuf * out);
+
+int stats_write_json(char const * path);
+
+#endif
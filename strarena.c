@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "strarena.h"
+
+/*
+ * starts an empty arena; nothing is allocated until the first string is interned
+ */
+void arena_init(StringArena *arena){
+	memset(arena, 0, sizeof(*arena));
+}
+
+/*
+ * releases every string and the interning table
+ */
+void arena_free(StringArena *arena){
+	for(int i = 0; i < arena->blockCount; i++){
+		free(arena->blocks[i]);
+	}
+	free(arena->blocks);
+	free(arena->table);
+	arena_init(arena);
+}
+
+/*
+ * FNV-1a hash of 'length' bytes
+ */
+static unsigned int hash_bytes(char const *str, size_t length){
+	unsigned int hash = 2166136261u;
+	for(size_t i = 0; i < length; i++){
+		hash ^= (unsigned char)str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*
+ * puts an already stored string into the table, which has room for it
+ */
+static void table_place(StringArena *arena, unsigned int hash, char const *str){
+	size_t mask = arena->tableCapacity - 1;
+	size_t slot = hash & mask;
+	while(arena->table[slot].str != NULL){
+		slot = (slot + 1) & mask;
+	}
+	arena->table[slot].hash = hash;
+	arena->table[slot].str = str;
+	arena->tableCount++;
+}
+
+/*
+ * doubles the table once it is half full
+ */
+static void table_reserve(StringArena *arena){
+	if((arena->tableCount + 1)*2 <= arena->tableCapacity){
+		return;
+	}
+
+	ArenaSlot *old = arena->table;
+	size_t oldCapacity = arena->tableCapacity;
+
+	arena->tableCapacity = oldCapacity == 0 ? 1024 : oldCapacity*2;
+	arena->table = calloc(arena->tableCapacity, sizeof(ArenaSlot));
+	if(arena->table == NULL){
+		fprintf(stderr, "Failed to allocate memory for string table.\n");
+		exit(1);
+	}
+	arena->tableCount = 0;
+	for(size_t i = 0; i < oldCapacity; i++){
+		if(old[i].str != NULL){
+			table_place(arena, old[i].hash, old[i].str);
+		}
+	}
+	free(old);
+}
+
+/*
+ * copies 'length' bytes plus a terminator into the current block, starting a new block if needed
+ */
+static char *store(StringArena *arena, char const *str, size_t length){
+	if(arena->blockCount == 0 || arena->blockUsed + length + 1 > ARENA_BLOCK_SIZE){
+		if(arena->blockCount == arena->blockCapacity){
+			arena->blockCapacity = arena->blockCapacity == 0 ? 16 : arena->blockCapacity*2;
+			arena->blocks = realloc(arena->blocks, arena->blockCapacity * sizeof(char *));
+			if(arena->blocks == NULL){
+				fprintf(stderr, "Failed to allocate memory for strings.\n");
+				exit(1);
+			}
+		}
+		size_t size = length + 1 > ARENA_BLOCK_SIZE ? length + 1 : ARENA_BLOCK_SIZE;
+		arena->blocks[arena->blockCount] = malloc(size);
+		if(arena->blocks[arena->blockCount] == NULL){
+			fprintf(stderr, "Failed to allocate memory for strings.\n");
+			exit(1);
+		}
+		arena->blockCount++;
+		arena->blockUsed = 0;
+	}
+
+	char *copy = arena->blocks[arena->blockCount - 1] + arena->blockUsed;
+	memcpy(copy, str, length);
+	copy[length] = '\0';
+	arena->blockUsed += length + 1;
+	arena->bytes += length + 1;
+	return copy;
+}
+
+/*
+ * @param *str first byte of the string, it does not need to be null terminated
+ * @param length number of bytes to intern
+ * @return the stored copy, shared with every other intern of the same bytes
+ */
+char const *arena_intern(StringArena *arena, char const *str, size_t length){
+	unsigned int hash = hash_bytes(str, length);
+
+	if(arena->pending != NULL){
+		arena_adopt_pending(arena);
+	}
+
+	if(arena->tableCapacity > 0){
+		size_t mask = arena->tableCapacity - 1;
+		for(size_t slot = hash & mask; arena->table[slot].str != NULL; slot = (slot + 1) & mask){
+			char const *candidate = arena->table[slot].str;
+			if(arena->table[slot].hash == hash && strncmp(candidate, str, length) == 0 && candidate[length] == '\0'){
+				return candidate;
+			}
+		}
+	}
+
+	table_reserve(arena);
+	char const *copy = store(arena, str, length);
+	table_place(arena, hash, copy);
+	return copy;
+}
+
+/*
+ * makes strings that live elsewhere (a mapped snapshot) available to arena_intern without copying them
+ * they only join the table on the first arena_intern or arena_adopt_pending, so a snapshot that is only read
+ * never pays for hashing them
+ * @param *strings null terminated strings one after another, each distinct
+ * @param length total length, terminators included
+ * the caller keeps that memory alive for as long as the arena is used
+ */
+void arena_adopt(StringArena *arena, char const *strings, size_t length){
+	arena->pending = strings;
+	arena->pendingBytes = length;
+}
+
+/*
+ * puts the strings given to arena_adopt into the table; arena_slot only finds them after this
+ */
+void arena_adopt_pending(StringArena *arena){
+	char const *strings = arena->pending;
+	size_t length = arena->pendingBytes;
+
+	arena->pending = NULL;
+	arena->pendingBytes = 0;
+	for(size_t offset = 0; offset < length; ){
+		size_t stringLength = strlen(strings + offset);
+		table_reserve(arena);
+		table_place(arena, hash_bytes(strings + offset, stringLength), strings + offset);
+		offset += stringLength + 1;
+	}
+}
+
+/*
+ * @param *str pointer returned by arena_intern, or a string passed to arena_adopt once arena_adopt_pending ran
+ * @return the table slot holding exactly that pointer, -1 if it was not interned in this arena
+ * slot numbers stay valid until the next string is interned
+ */
+long arena_slot(StringArena const *arena, char const *str){
+	if(arena->tableCapacity == 0){
+		return -1;
+	}
+	size_t mask = arena->tableCapacity - 1;
+	for(size_t slot = hash_bytes(str, strlen(str)) & mask; arena->table[slot].str != NULL; slot = (slot + 1) & mask){
+		if(arena->table[slot].str == str){
+			return slot;
+		}
+	}
+	return -1;
+}
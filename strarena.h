@@ -0,0 +1,45 @@
+#ifndef STRARENA_H
+#define STRARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+/*
+ * one entry of the interning table
+ */
+typedef struct ArenaSlot {
+ unsigned int hash;
+ char const *str; //NULL if the slot is empty
+} ArenaSlot;
+
+/*
+ * append-only storage for null terminated strings with deduplicating interning
+ * interned strings never move, so pointers to them stay valid until arena_free
+ */
+typedef struct StringArena {
+ char **blocks; //every block allocated so far, the last one is being filled
+ int blockCount;
+ int blockCapacity;
+ size_t blockUsed; //bytes used in the last block
+ ArenaSlot *table; //open addressing set of every interned string
+ size_t tableCapacity; //power of two, 0 until the first string is interned
+ size_t tableCount;
+ size_t bytes; //bytes of string data held, terminators included
+ char const *pending; //strings handed to arena_adopt that are not in the table yet, NULL if none
+ size_t pendingBytes;
+} StringArena;
+
+void arena_init(StringArena * arena);
+
+void arena_free(StringArena * arena);
+
+char const *arena_intern(StringArena * arena, char const * str, size_t length);
+
+void arena_adopt(StringArena * arena, char const * strings, size_t length);
+
+void arena_adopt_pending(StringArena * arena);
+
+long arena_slot(StringArena const * arena, char const * str);
+
+#endif
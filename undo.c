@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "undo.h"
+
+/*
+ * remembers a change that is about to be made; it joins the open step until undo_push or a commit closes it
+ * @param char kind JOURNAL_ADD, JOURNAL_UPDATE or JOURNAL_DELETE
+ * @param *before the record as it is before the change, or for an add any record with the new handle
+ */
+void undo_record(UndoHistory *history, char kind, Record const *before){
+	UndoStep *open = &history->open;
+	if(open->count == open->capacity){
+		open->capacity = open->capacity == 0 ? 4 : open->capacity * 2;
+		open->entries = realloc(open->entries, open->capacity * sizeof(UndoEntry));
+		if(open->entries == NULL){
+			fprintf(stderr, "Failed memory allocation.\n");
+			exit(1);
+		}
+	}
+	UndoEntry *entry = &open->entries[open->count];
+	entry->kind = kind;
+	entry->before = *before;
+	strncpy(entry->comment, before->comment != NULL ? before->comment : "", COMMENT_SIZE - 1);
+	entry->comment[COMMENT_SIZE - 1] = '\0';
+	entry->before.comment = NULL; //'comment' holds it
+	open->count++;
+}
+
+/*
+ * closes the open step and makes it the one 'undo' reverts next; the oldest step is forgotten once there are UNDO_DEPTH
+ */
+void undo_push(UndoHistory *history){
+	if(history->open.count == 0){
+		return;
+	}
+	if(history->count == UNDO_DEPTH){
+		free(history->steps[history->first].entries);
+		history->first = (history->first + 1) % UNDO_DEPTH;
+		history->count--;
+	}
+	history->steps[(history->first + history->count) % UNDO_DEPTH] = history->open;
+	history->count++;
+	memset(&history->open, 0, sizeof(history->open));
+}
+
+/*
+ * reverts the changes of a step newest first and empties it; each change costs one hash lookup, so k changes cost O(k)
+ * a deleted record comes back at the end of the table rather than at its old position
+ * @param now date a reverted update is stamped with, as any update is; 0 to restore the date it had, as a rollback does
+ * @param changed called with each change the revert makes, NULL if they need not be reported
+ * @return the number of changes reverted
+ */
+int undo_revert(Database *db, UndoStep *step, unsigned long now, UndoChanged changed, int *flag){
+	int reverted = 0;
+
+	for(int i = step->count - 1; i >= 0; i--){
+		UndoEntry const *entry = &step->entries[i];
+		Record *rec = db_lookup(db, entry->before.handle);
+		if(entry->kind == JOURNAL_ADD){
+			if(rec == NULL){
+				continue;
+			}
+			Record removed = *rec;
+			char comment[COMMENT_SIZE]; //a delete can reclaim the comment's storage
+			removed.comment = strcpy(comment, rec->comment);
+			db_remove(db, removed.handle);
+			if(changed != NULL){
+				changed(db, JOURNAL_DELETE, &removed, flag);
+			}
+		}else if(entry->kind == JOURNAL_UPDATE){
+			if(rec == NULL){
+				continue;
+			}
+			db_update_record(db, rec, entry->before.followerCount, entry->comment, now != 0 ? now : entry->before.dateLastModified);
+			if(changed != NULL){
+				changed(db, JOURNAL_UPDATE, rec, flag);
+			}
+		}else{
+			if(rec != NULL){
+				continue;
+			}
+			Record restored = entry->before;
+			restored.comment = entry->comment;
+			db_append(db, &restored);
+			if(changed != NULL){
+				changed(db, JOURNAL_ADD, &db->records[db->size - 1], flag);
+			}
+		}
+		reverted++;
+	}
+	free(step->entries);
+	memset(step, 0, sizeof(*step));
+	return reverted;
+}
+
+/*
+ * reverts the most recent step, stamping the updates it reverts with 'now'
+ * @return the number of changes reverted, -1 if there is nothing to undo
+ */
+int undo_last(Database *db, UndoHistory *history, unsigned long now, UndoChanged changed, int *flag){
+	if(history->count == 0){
+		return -1;
+	}
+	history->count--;
+	return undo_revert(db, &history->steps[(history->first + history->count) % UNDO_DEPTH], now, changed, flag);
+}
+
+/*
+ * reports one change per handle the step touched, taking it from its state before the step to its state now:
+ * an add, an update, a delete, or nothing if the handle neither existed before nor exists now
+ * this is what a transaction writes to the journal when it commits
+ * @return the number of changes reported
+ */
+int undo_final_changes(Database *db, UndoStep const *step, UndoChanged changed, int *flag){
+	int capacity = 16;
+	while(capacity < step->count * 2){
+		capacity *= 2;
+	}
+	int *seen = malloc(capacity * sizeof(int)); //entry of the first change to each handle, open addressing on handle
+	if(seen == NULL){
+		fprintf(stderr, "Failed memory allocation.\n");
+		exit(1);
+	}
+	memset(seen, -1, capacity * sizeof(int));
+
+	int reported = 0;
+	for(int i = 0; i < step->count; i++){
+		UndoEntry const *entry = &step->entries[i];
+		unsigned int slot = db_hash(entry->before.handle) & (capacity - 1);
+		while(seen[slot] != -1 && strcmp(step->entries[seen[slot]].before.handle, entry->before.handle) != 0){
+			slot = (slot + 1) & (capacity - 1);
+		}
+		if(seen[slot] != -1){
+			continue; //only the first change shows whether the handle existed before the step
+		}
+		seen[slot] = i;
+
+		int existed = entry->kind != JOURNAL_ADD;
+		Record *rec = db_lookup(db, entry->before.handle);
+		if(rec != NULL){
+			changed(db, existed ? JOURNAL_UPDATE : JOURNAL_ADD, rec, flag);
+		}else if(existed){
+			Record removed = entry->before;
+			removed.comment = entry->comment;
+			changed(db, JOURNAL_DELETE, &removed, flag);
+		}else{
+			continue;
+		}
+		reported++;
+	}
+	free(seen);
+	return reported;
+}
+
+/*
+ * forgets every step and the open transaction without reverting anything
+ */
+void undo_clear(UndoHistory *history){
+	for(int i = 0; i < history->count; i++){
+		free(history->steps[(history->first + i) % UNDO_DEPTH].entries);
+	}
+	free(history->open.entries);
+	memset(history, 0, sizeof(*history));
+}
@@ -0,0 +1,55 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+#include "database.h"
+#include "journal.h"
+
+//number of commands or committed transactions 'undo' can go back through
+#define UNDO_DEPTH 100
+
+/*
+ * one change as it can be reverted: what was done to a handle and the record as it was before
+ * entries are keyed by handle rather than record number, since compaction renumbers records
+ */
+typedef struct UndoEntry {
+ char kind; //JOURNAL_ADD, JOURNAL_UPDATE or JOURNAL_DELETE, the change that was made
+ Record before; //the record before an update or delete, its comment NULL; only the handle is used for an add
+ char comment[COMMENT_SIZE]; //the comment of 'before', copied since the database can free the one it pointed to
+} UndoEntry;
+
+/*
+ * the changes of one command or one transaction, oldest first
+ */
+typedef struct UndoStep {
+ UndoEntry *entries;
+ int count;
+ int capacity;
+} UndoStep;
+
+/*
+ * the most recent steps, and the changes of the transaction that is running, if any
+ */
+typedef struct UndoHistory {
+ UndoStep steps[UNDO_DEPTH]; //ring, the oldest step at 'first'
+ int first;
+ int count;
+ UndoStep open; //changes not yet part of a step
+ int inTransaction; //1 between 'begin' and 'commit' or 'rollback'
+} UndoHistory;
+
+//called for each change a revert or a commit makes, with the record as journal_append expects it
+typedef void (*UndoChanged)(Database * db, char op, Record const * record, int * flag);
+
+void undo_record(UndoHistory * history, char kind, Record const * before);
+
+void undo_push(UndoHistory * history);
+
+int undo_revert(Database * db, UndoStep * step, unsigned long now, UndoChanged changed, int * flag);
+
+int undo_last(Database * db, UndoHistory * history, unsigned long now, UndoChanged changed, int * flag);
+
+int undo_final_changes(Database * db, UndoStep const * step, UndoChanged changed, int * flag);
+
+void undo_clear(UndoHistory * history);
+
+#endif
@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "wordindex.h"
+#include "handleindex.h"
+
+//a posting list's pending updates are merged once there are more than this plus an eighth of its sorted part
+#define WORD_MIN_PENDING 64
+
+static void *checked_realloc(void *ptr, size_t bytes){
+	ptr = realloc(ptr, bytes);
+	if(ptr == NULL){
+		fprintf(stderr, "Failed to allocate memory for index.\n");
+		exit(1);
+	}
+	return ptr;
+}
+
+static int is_word_byte(unsigned char c){
+	return isalnum(c) || c >= 0x80;
+}
+
+/*
+ * copies the next word of *text into 'word' in lowercase and moves *text past it
+ * words longer than COMMENT_SIZE - 1 bytes are cut, no comment can hold them anyway
+ * @return the full length of the word, 0 once the text holds no more words
+ */
+static size_t next_word(char const **text, char word[COMMENT_SIZE]){
+	unsigned char const *at = (unsigned char const *)*text;
+	size_t length = 0;
+
+	while(*at != '\0' && !is_word_byte(*at)){
+		at++;
+	}
+	for(; is_word_byte(*at); at++, length++){
+		if(length < COMMENT_SIZE - 1){
+			word[length] = tolower(*at);
+		}
+	}
+	word[length < COMMENT_SIZE - 1 ? length : COMMENT_SIZE - 1] = '\0';
+	*text = (char const *)at;
+	return length;
+}
+
+/*
+ * @return 1 if 'comment' contains 'word' as a whole word
+ */
+static int has_word(char const *comment, char const *word){
+	char token[COMMENT_SIZE];
+	while(next_word(&comment, token) > 0){
+		if(strcmp(token, word) == 0){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * @return the posting list of 'word', or NULL if no comment contains it
+ */
+static WordPosting *word_lookup(WordIndex const *index, char const *word){
+	unsigned int hash = db_hash(word);
+	unsigned int mask = index->capacity - 1;
+	for(unsigned int slot = hash & mask; index->table[slot].word != NULL; slot = (slot + 1) & mask){
+		if(index->table[slot].hash == hash && strcmp(index->table[slot].word, word) == 0){
+			return &index->table[slot];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * doubles the table, moving each posting list to its new slot
+ */
+static void word_grow(WordIndex *index){
+	WordPosting *old = index->table;
+	int oldCapacity = index->capacity;
+
+	index->capacity *= 2;
+	index->table = calloc(index->capacity, sizeof(WordPosting));
+	if(index->table == NULL){
+		fprintf(stderr, "Failed to allocate memory for index.\n");
+		exit(1);
+	}
+	unsigned int mask = index->capacity - 1;
+	for(int i = 0; i < oldCapacity; i++){
+		if(old[i].word == NULL){
+			continue;
+		}
+		unsigned int slot = old[i].hash & mask;
+		while(index->table[slot].word != NULL){
+			slot = (slot + 1) & mask;
+		}
+		index->table[slot] = old[i];
+	}
+	free(old);
+}
+
+/*
+ * @return the posting list of 'word', adding an empty one if there is none yet
+ */
+static WordPosting *word_insert(WordIndex *index, char const *word){
+	WordPosting *posting = word_lookup(index, word);
+	if(posting != NULL){
+		return posting;
+	}
+	if((index->used + 1) * 2 > index->capacity){
+		word_grow(index);
+	}
+	unsigned int hash = db_hash(word);
+	unsigned int mask = index->capacity - 1;
+	unsigned int slot = hash & mask;
+	while(index->table[slot].word != NULL){
+		slot = (slot + 1) & mask;
+	}
+	posting = &index->table[slot];
+	posting->word = strdup(word);
+	if(posting->word == NULL){
+		fprintf(stderr, "Failed to allocate memory for index.\n");
+		exit(1);
+	}
+	posting->hash = hash;
+	index->used++;
+	return posting;
+}
+
+static void push_id(int **ids, int *count, int *capacity, int id){
+	if(*count == *capacity){
+		*capacity = *capacity == 0 ? 4 : *capacity * 2;
+		*ids = checked_realloc(*ids, *capacity * sizeof(int));
+	}
+	(*ids)[(*count)++] = id;
+}
+
+static int compare_ids(void const *a, void const *b){
+	int x = *(int const *)a;
+	int y = *(int const *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * merges the sorted list of a posting with its pending updates
+ * @param *records if not NULL, records whose comment no longer holds the word are left out
+ * @param *count set to the length of the result
+ * @return a malloc'd sorted array without duplicates
+ */
+static int *merge_posting(WordPosting const *posting, Record const *records, int *count){
+	int *pending = checked_realloc(NULL, (posting->pendingCount + 1) * sizeof(int));
+	memcpy(pending, posting->pending, posting->pendingCount * sizeof(int));
+	qsort(pending, posting->pendingCount, sizeof(int), compare_ids);
+
+	int *merged = checked_realloc(NULL, (posting->count + posting->pendingCount + 1) * sizeof(int));
+	int length = 0;
+	int i = 0;
+	int j = 0;
+	while(i < posting->count || j < posting->pendingCount){
+		int id;
+		if(j == posting->pendingCount || (i < posting->count && posting->ids[i] < pending[j])){
+			id = posting->ids[i++];
+		}else{
+			id = pending[j++];
+		}
+		if(length > 0 && merged[length - 1] == id){
+			continue;
+		}
+		if(records != NULL && !has_word(records[id].comment, posting->word)){
+			continue;
+		}
+		merged[length++] = id;
+	}
+	free(pending);
+	*count = length;
+	return merged;
+}
+
+/*
+ * builds a word index over the comments of the first 'size' records
+ */
+WordIndex *word_build(Record const *records, int size){
+	WordIndex *index = malloc(sizeof(WordIndex));
+	if(index == NULL){
+		fprintf(stderr, "Failed to allocate memory for index.\n");
+		exit(1);
+	}
+	index->capacity = 1024;
+	index->used = 0;
+	index->table = calloc(index->capacity, sizeof(WordPosting));
+	if(index->table == NULL){
+		fprintf(stderr, "Failed to allocate memory for index.\n");
+		exit(1);
+	}
+	for(int i = 0; i < size; i++){
+		word_add(index, records, i);
+	}
+	return index;
+}
+
+/*
+ * adds record 'id', which must be the highest record number so far, to the posting list of every word in its comment
+ */
+void word_add(WordIndex *index, Record const *records, int id){
+	char const *comment = records[id].comment;
+	char word[COMMENT_SIZE];
+
+	while(next_word(&comment, word) > 0){
+		WordPosting *posting = word_insert(index, word);
+		if(posting->count > 0 && posting->ids[posting->count - 1] == id){
+			continue; //word repeats inside this comment
+		}
+		push_id(&posting->ids, &posting->count, &posting->capacity, id);
+	}
+}
+
+/*
+ * records that the comment of record 'id' changed
+ * the record joins the lists of its new words; lists of words it lost are cleaned up when they are merged
+ */
+void word_update(WordIndex *index, Record const *records, int id){
+	char const *comment = records[id].comment;
+	char word[COMMENT_SIZE];
+
+	while(next_word(&comment, word) > 0){
+		WordPosting *posting = word_insert(index, word);
+		int position = posting_seek(posting->ids, 0, posting->count, id);
+		if((position < posting->count && posting->ids[position] == id)
+		   || (posting->pendingCount > 0 && posting->pending[posting->pendingCount - 1] == id)){
+			continue; //already listed
+		}
+		push_id(&posting->pending, &posting->pendingCount, &posting->pendingCapacity, id);
+		if(posting->pendingCount > WORD_MIN_PENDING + posting->count / 8){
+			int count;
+			int *merged = merge_posting(posting, records, &count);
+			free(posting->ids);
+			posting->ids = merged;
+			posting->capacity = posting->count + posting->pendingCount + 1;
+			posting->count = count;
+			posting->pendingCount = 0;
+		}
+	}
+}
+
+/*
+ * finds every record whose comment contains all words of 'query'
+ * the posting lists are intersected shortest first and each candidate is confirmed against its current comment
+ * @param **ids set to a malloc'd array of the matching record numbers in ascending order, the caller frees it
+ * @return the number of matches, -1 if the query holds no words
+ */
+int word_search(WordIndex const *index, Record const *records, char const *query, int **ids){
+	size_t queryLength = strlen(query);
+	char (*words)[COMMENT_SIZE] = checked_realloc(NULL, (queryLength / 2 + 2) * sizeof(*words));
+	int wordCount = 0;
+	int missing = 0;
+	size_t length;
+
+	while((length = next_word(&query, words[wordCount])) > 0){
+		if(length >= COMMENT_SIZE){
+			missing = 1; //longer than any comment
+		}
+		wordCount++;
+	}
+	if(wordCount == 0){
+		free(words);
+		*ids = NULL;
+		return -1;
+	}
+
+	//lists with pending updates are searched through a merged copy
+	int **lists = checked_realloc(NULL, wordCount * sizeof(int *));
+	int *counts = checked_realloc(NULL, wordCount * sizeof(int));
+	int *owned = checked_realloc(NULL, wordCount * sizeof(int));
+	int shortest = 0;
+	for(int w = 0; w < wordCount; w++){
+		WordPosting const *posting = missing ? NULL : word_lookup(index, words[w]);
+		owned[w] = 0;
+		if(posting == NULL){
+			missing = 1;
+			lists[w] = NULL;
+			counts[w] = 0;
+			continue;
+		}
+		if(posting->pendingCount > 0){
+			lists[w] = merge_posting(posting, NULL, &counts[w]);
+			owned[w] = 1;
+		}else{
+			lists[w] = posting->ids;
+			counts[w] = posting->count;
+		}
+		if(counts[w] < counts[shortest]){
+			shortest = w;
+		}
+	}
+
+	int count = missing ? 0 : counts[shortest];
+	int *found = checked_realloc(NULL, (count + 1) * sizeof(int));
+	if(count > 0){
+		memcpy(found, lists[shortest], count * sizeof(int));
+	}
+	for(int w = 0; w < wordCount && count > 0; w++){
+		if(w == shortest){
+			continue;
+		}
+		int kept = 0;
+		int position = 0;
+		for(int i = 0; i < count; i++){
+			position = posting_seek(lists[w], position, counts[w], found[i]);
+			if(position == counts[w]){
+				break;
+			}
+			if(lists[w][position] == found[i]){
+				found[kept++] = found[i];
+			}
+		}
+		count = kept;
+	}
+
+	//the lists may still name records whose comment has since lost a word
+	int kept = 0;
+	for(int i = 0; i < count; i++){
+		int all = 1;
+		for(int w = 0; w < wordCount && all; w++){
+			all = has_word(records[found[i]].comment, words[w]);
+		}
+		if(all){
+			found[kept++] = found[i];
+		}
+	}
+
+	for(int w = 0; w < wordCount; w++){
+		if(owned[w]){
+			free(lists[w]);
+		}
+	}
+	free(lists);
+	free(counts);
+	free(owned);
+	free(words);
+	*ids = found;
+	return kept;
+}
+
+void word_free(WordIndex *index){
+	if(index == NULL){
+		return;
+	}
+	for(int i = 0; i < index->capacity; i++){
+		free(index->table[i].word);
+		free(index->table[i].ids);
+		free(index->table[i].pending);
+	}
+	free(index->table);
+	free(index);
+}
@@ -0,0 +1,43 @@
+#ifndef WORDINDEX_H
+#define WORDINDEX_H
+
+#include "database.h"
+
+/*
+ * record numbers whose comment contains one word
+ * ids is sorted; records whose comment gained the word since the last merge wait in pending
+ * entries are not removed when a comment loses the word, searches confirm every match against the current comment
+ * and merges drop the stale ones
+ */
+typedef struct WordPosting {
+ char *word; //lowercase word, NULL if the slot is empty
+ unsigned int hash;
+ int *ids;
+ int count;
+ int capacity;
+ int *pending; //unsorted record numbers added by updates
+ int pendingCount;
+ int pendingCapacity;
+} WordPosting;
+
+/*
+ * inverted index from each word that occurs in some comment to the records containing it
+ * a word is a run of letters, digits and non-ASCII bytes, compared without regard to ASCII case
+ */
+typedef struct WordIndex {
+ WordPosting *table; //open addressing on hash
+ int capacity; //number of slots, always a power of two
+ int used; //number of occupied slots
+} WordIndex;
+
+WordIndex *word_build(Record const * records, int size);
+
+void word_add(WordIndex * index, Record const * records, int id);
+
+void word_update(WordIndex * index, Record const * records, int id);
+
+int word_search(WordIndex const * index, Record const * records, char const * query, int ** ids);
+
+void word_free(WordIndex * index);
+
+#endif